@@ -1,11 +1,17 @@
 #include "resource.h"
 #include "bonnet.h"
+#include "control.h"
+#include "events.h"
+#include "replicas.h"
+#include "telemetry.h"
 #include <fstream>
 #include <numeric>
 #include <cxxopts.hpp>
 #include <iostream>
 #include <format>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include "process.hpp"
 
 namespace utils
@@ -60,6 +66,43 @@ namespace utils
         }
     }
 
+    static std::string to_string(const std::vector<int>& values)
+    {
+        std::string out;
+        for (const auto v : values)
+        {
+            out += std::format("{}{}", out.empty() ? "" : ",", v);
+        }
+        return out;
+    }
+
+    static std::string to_string(bonnet::process_priority priority)
+    {
+        switch (priority)
+        {
+        case bonnet::process_priority::idle:
+            return "idle";
+        case bonnet::process_priority::below_normal:
+            return "below-normal";
+        case bonnet::process_priority::above_normal:
+            return "above-normal";
+        default:
+            return "normal";
+        }
+    }
+
+    static bonnet::process_priority to_process_priority(const std::string& s)
+    {
+        for (const auto priority : { bonnet::process_priority::idle, bonnet::process_priority::below_normal, bonnet::process_priority::normal, bonnet::process_priority::above_normal })
+        {
+            if (to_string(priority) == s)
+            {
+                return priority;
+            }
+        }
+        throw std::runtime_error(std::format("unknown priority: '{}'", s));
+    }
+
     inline std::string timestamp_string()
     {
         return std::format("{:%Y-%m-%d %X}", std::chrono::current_zone()->to_local(std::chrono::system_clock::now()));
@@ -126,12 +169,110 @@ namespace window_utils
     }
 }
 
+namespace scheduling_utils
+{
+    using unique_handle = std::unique_ptr<void, decltype(&CloseHandle)>;
+
+    static DWORD_PTR cpu_mask(const std::vector<int>& cpus)
+    {
+        DWORD_PTR mask = 0;
+        for (const auto cpu : cpus)
+        {
+            if (cpu < 0 || cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+            {
+                throw std::runtime_error(std::format("invalid cpu index: {}", cpu));
+            }
+            mask |= DWORD_PTR{ 1 } << cpu;
+        }
+        return mask;
+    }
+
+    static DWORD_PTR process_mask()
+    {
+        DWORD_PTR process_affinity = 0, system_affinity = 0;
+        GetProcessAffinityMask(GetCurrentProcess(), &process_affinity, &system_affinity);
+        return process_affinity;
+    }
+
+    // CPUs left to everything but the UI thread (0 means no restriction)
+    static DWORD_PTR non_ui_mask(const bonnet::config& config)
+    {
+        if (config.ui_cpu < 0)
+        {
+            return 0;
+        }
+        return process_mask() & ~cpu_mask({ config.ui_cpu }); // 0 on a single-core box: nothing to move away
+    }
+
+    static DWORD to_priority_class(bonnet::process_priority priority)
+    {
+        switch (priority)
+        {
+        case bonnet::process_priority::idle:
+            return IDLE_PRIORITY_CLASS;
+        case bonnet::process_priority::below_normal:
+            return BELOW_NORMAL_PRIORITY_CLASS;
+        case bonnet::process_priority::above_normal:
+            return ABOVE_NORMAL_PRIORITY_CLASS;
+        default:
+            return NORMAL_PRIORITY_CLASS;
+        }
+    }
+
+    // the job object holds the backend and all of its children, so that limits are inherited
+    static unique_handle create_backend_job(const bonnet::config& config)
+    {
+        const auto affinity = config.backend_cpus.empty() ? non_ui_mask(config) : cpu_mask(config.backend_cpus);
+        if (config.backend_priority == bonnet::process_priority::normal && !affinity)
+        {
+            return { nullptr, CloseHandle };
+        }
+
+        unique_handle job{ CreateJobObjectW(nullptr, nullptr), CloseHandle };
+        if (!job)
+        {
+            throw std::runtime_error("can't create backend job object");
+        }
+
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+        if (config.backend_priority != bonnet::process_priority::normal)
+        {
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_PRIORITY_CLASS;
+            limits.BasicLimitInformation.PriorityClass = to_priority_class(config.backend_priority);
+        }
+        if (affinity)
+        {
+            limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+            limits.BasicLimitInformation.Affinity = affinity;
+        }
+        if (!SetInformationJobObject(job.get(), JobObjectExtendedLimitInformation, &limits, sizeof(limits)))
+        {
+            throw std::runtime_error(std::format("can't apply backend scheduling policy (error={})", GetLastError()));
+        }
+        return job;
+    }
+
+    static void pin_current_thread(DWORD_PTR mask)
+    {
+        if (mask)
+        {
+            SetThreadAffinityMask(GetCurrentThread(), mask);
+        }
+    }
+}
+
 namespace options
 {
     inline const std::string fullscreen = "kiosk-mode";
     inline const std::string maximize = "maximize";
     inline const std::string debug = "debug";
     inline const std::string backend_no_log = "backend-no-log";
+    inline const std::string backend_events = "backend-events";
+    inline const std::string backend_events_prefix = "backend-events-prefix";
+    inline const std::string backend_control = "backend-control";
+    inline const std::string backend_replicas = "backend-replicas";
+    inline const std::string backend_max_in_flight = "backend-max-in-flight";
+    inline const std::string backend_rpc = "backend-rpc";
     inline const std::string no_log_at_all = "no-log";
 	inline const std::string url = "url";
     inline const std::string width = "width";
@@ -142,6 +283,13 @@ namespace options
     inline const std::string backend_show_console = "backend-console";
     inline const std::string title = "title";
     inline const std::string icon = "icon";
+    inline const std::string backend_priority = "backend-priority";
+    inline const std::string backend_cpus = "backend-cpus";
+    inline const std::string ui_cpu = "ui-cpu";
+    inline const std::string telemetry_buffer = "telemetry-buffer";
+    inline const std::string telemetry_max_batch = "telemetry-max-batch";
+    inline const std::string stats_interval = "stats-interval";
+    inline const std::string rpc_timeout = "rpc-timeout";
     inline const std::string help = "help";
 
     static cxxopts::Options& options_repository()
@@ -163,6 +311,19 @@ namespace options
                 (backend_args, "Backend process arguments", cxxopts::value<std::vector<std::string>>()->default_value(utils::to_string(default_config.backend_args)))
                 (backend_show_console, "Show console of backend process", cxxopts::value<bool>()->default_value(utils::to_string(default_config.backend_show_console)))
                 (backend_no_log, "Disable backend output to file", cxxopts::value<bool>()->default_value(utils::to_string(default_config.backend_no_log)))
+                (backend_events, "Forward backend output events to the page", cxxopts::value<bool>()->default_value(utils::to_string(default_config.backend_events)))
+                (backend_events_prefix, "Prefix of backend output events (default: JSON objects)", cxxopts::value<std::string>()->default_value(default_config.backend_events_prefix))
+                (backend_control, "Let the backend drive the window through a named pipe", cxxopts::value<bool>()->default_value(utils::to_string(default_config.backend_control)))
+                (backend_replicas, "Number of backend replicas serving JSON-RPC calls over standard I/O", cxxopts::value<size_t>()->default_value(std::to_string(default_config.backend_replicas)))
+                (backend_max_in_flight, "Max pending JSON-RPC calls per backend replica", cxxopts::value<size_t>()->default_value(std::to_string(default_config.backend_max_in_flight)))
+                (backend_rpc, "Name of the function calling backend replicas", cxxopts::value<std::string>()->default_value(default_config.backend_rpc))
+                (backend_priority, "Backend process priority (idle, below-normal, normal, above-normal)", cxxopts::value<std::string>()->default_value(utils::to_string(default_config.backend_priority)))
+                (backend_cpus, "CPUs the backend process (and its children) can run on", cxxopts::value<std::vector<int>>())
+                (ui_cpu, "CPU reserved to the window thread", cxxopts::value<int>()->default_value(std::to_string(default_config.ui_cpu)))
+                (telemetry_buffer, "Size (KB) of the backend telemetry shared buffer (0 disables)", cxxopts::value<size_t>()->default_value(std::to_string(default_config.telemetry_buffer_kb)))
+                (telemetry_max_batch, "Max telemetry records delivered to the page per frame (0 means no limit)", cxxopts::value<size_t>()->default_value(std::to_string(default_config.telemetry_max_batch)))
+                (stats_interval, "Seconds between RPC statistics written to the log (0 disables statistics)", cxxopts::value<size_t>()->default_value(std::to_string(default_config.stats_interval_s)))
+                (rpc_timeout, "Seconds before calls from the page still pending are rejected (0 means no timeout)", cxxopts::value<size_t>()->default_value(std::to_string(default_config.rpc_timeout_s)))
                 (debug, "Enable build tools", cxxopts::value<bool>()->default_value(utils::to_string(default_config.debug)))
                 (no_log_at_all, "Disable all logs to file", cxxopts::value<bool>()->default_value(utils::to_string(default_config.no_log_at_all)));
             return options;
@@ -185,16 +346,20 @@ struct file_logger : bonnet::logger_t
     {
     }
 
+    // backend readers, telemetry, control and statistics threads log at the same time
     void log_from_process(const char* bytes, size_t n) override
     {
+        std::lock_guard lock{ m_mutex };
         m_stream.write(bytes, static_cast<std::streamsize>(n));
     }
 
 	void log_from_bonnet(const std::string& message) override
     {
+        std::lock_guard lock{ m_mutex };
     	m_stream << "[bonnet] " << message << "\n";
     }
 private:
+    std::mutex m_mutex;
     std::ofstream m_stream;
 };
 
@@ -213,8 +378,18 @@ bonnet::launcher::launcher(config config, web_view_functions fns, logger logger)
 {
 }
 
-static std::function<void(const char* bytes, size_t n)> backend_create_stdout_function(const bonnet::config& config, bonnet::logger logger)
+static std::function<void(const char* bytes, size_t n)> backend_create_stdout_function(const bonnet::config& config, bonnet::logger logger, bonnet::page_events& events)
 {
+    if (config.backend_events && config.backend_show_console)
+    {
+        logger->log_from_bonnet("config: backend events are not available when backend console is shown");
+    }
+    else if (config.backend_events)
+    {
+        logger->log_from_bonnet(std::format("config: will forward backend output events to the page (prefix='{}')", config.backend_events_prefix));
+        return bonnet::create_backend_events_function(config, std::move(logger), events);
+    }
+
     if (!config.backend_no_log && !config.backend_show_console)
     {
         logger->log_from_bonnet("config: will redirect backend output to log file");
@@ -232,33 +407,111 @@ void bonnet::launcher::launch_and_wait()
     } };
     m_logger->log_from_bonnet(std::format("started at {}", utils::timestamp_string()));
 
+    if (m_config.ui_cpu >= 0)
+    {
+        scheduling_utils::pin_current_thread(scheduling_utils::cpu_mask({ m_config.ui_cpu }));
+        m_logger->log_from_bonnet(std::format("config: ui_cpu={}", m_config.ui_cpu));
+    }
+
     webview::webview w(m_config.debug, nullptr);
+    w.set_shim_listener([this](size_t bindings, size_t bytes, std::chrono::microseconds elapsed) {
+        m_logger->log_from_bonnet(std::format("bindings script: {} bindings, {} bytes, injected in {}us", bindings, bytes, elapsed.count()));
+    });
     for (const auto& decorator : m_web_view_decorators)
     {
         decorator(w, *m_logger);
     }
 
+    if (m_config.rpc_timeout_s)
+    {
+        m_logger->log_from_bonnet(std::format("config: rpc timeout={}s", m_config.rpc_timeout_s));
+        w.set_call_timeout(std::chrono::seconds(m_config.rpc_timeout_s));
+    }
+
+    // statistics are exposed to the page and written to the log periodically
+    std::jthread stats_writer;
+    if (m_config.stats_interval_s)
+    {
+        m_logger->log_from_bonnet(std::format("config: stats interval={}s", m_config.stats_interval_s));
+        w.enable_stats(true);
+        w.bind("__bonnet_stats", [&w](std::string) {
+            return w.stats_json();
+        });
+        stats_writer = std::jthread([this, &w, interval = std::chrono::seconds(m_config.stats_interval_s)](std::stop_token st) {
+            std::mutex mutex;
+            std::condition_variable_any stopped;
+            std::unique_lock lock{ mutex };
+            while (!stopped.wait_for(lock, st, interval, [&st] { return st.stop_requested(); }))
+            {
+                m_logger->log_from_bonnet(std::format("stats: {}", w.stats_json()));
+            }
+        });
+    }
+
+    page_events events{ w, m_logger };
+    std::unique_ptr<telemetry_channel> telemetry;
+    std::unique_ptr<control_channel> control;
+    std::unique_ptr<replica_pool> replicas;
+    // the replica bindings call the pool, so they go before it does
+    utils::defer unbind_replicas{ [&] {
+        if (replicas)
+        {
+            w.unbind(m_config.backend_rpc);
+            w.unbind(m_config.backend_rpc + "_notify");
+        }
+    } };
     std::jthread backend_worker;
     if (!m_config.backend.empty())
     {
         m_logger->log_from_bonnet(std::format("config: backend={} show_console={} arguments={}", m_config.backend, m_config.backend_show_console, utils::to_string(m_config.backend_args)));
+        m_logger->log_from_bonnet(std::format("config: backend priority={} cpus={}", utils::to_string(m_config.backend_priority), m_config.backend_cpus.empty() ? "default" : utils::to_string(m_config.backend_cpus)));
 
-        std::unique_ptr<TinyProcessLib::Process> process = std::make_unique<TinyProcessLib::Process>(
-            utils::join_backend_and_args(m_config.backend, m_config.backend_args), 
-            utils::to_wstring(m_config.backend_workdir), 
-            backend_create_stdout_function(m_config, m_logger), nullptr, false, TinyProcessLib::Config{ .show_window = m_config.backend_show_console ? TinyProcessLib::Config::ShowWindow::show_default : TinyProcessLib::Config::ShowWindow::hide });
+        auto job = scheduling_utils::create_backend_job(m_config);
+        const auto non_ui_mask = scheduling_utils::non_ui_mask(m_config);
 
-    	backend_worker = std::jthread([this, p=std::move(process), &w](std::stop_token st) {
-    		if (const auto exit = p->get_exit_status(st); exit)
-            {
-                m_logger->log_from_bonnet(std::format("backend process exited autonomously. Exit code={}", *exit));
-                w.terminate();
-            }
-            else
-            {
-                m_logger->log_from_bonnet(std::format("backend process exited after bonnet sent a graceful shutdown. Exit code={}", p->ctrl_c()));
-            }
-        });
+        if (m_config.telemetry_buffer_kb)
+        {
+            telemetry = std::make_unique<telemetry_channel>(m_config, m_logger, events, non_ui_mask);
+        }
+        if (m_config.backend_control)
+        {
+            control = std::make_unique<control_channel>(m_logger, w, events, non_ui_mask);
+        }
+
+        const TinyProcessLib::Config process_config{ .show_window = m_config.backend_show_console ? TinyProcessLib::Config::ShowWindow::show_default : TinyProcessLib::Config::ShowWindow::hide, .job = job.get(), .reader_affinity = non_ui_mask };
+
+        if (m_config.backend_replicas > 1)
+        {
+            replicas = std::make_unique<replica_pool>(m_config, m_logger, w, std::move(job), process_config, create_backend_line_function(m_config, m_logger, events));
+            // calls are stopped when the page aborts them, they time out or the page goes away
+            w.bind(m_config.backend_rpc, [&replicas](std::string seq, std::string request, std::stop_token stop) {
+                replicas->call(seq, request, std::move(stop));
+            });
+            // calls that need no reply (e.g. telemetry) are sent as JSON-RPC notifications
+            w.bind_notification(m_config.backend_rpc + "_notify", [&replicas](std::string request) {
+                replicas->notify(request);
+            });
+        }
+        else
+        {
+            std::unique_ptr<TinyProcessLib::Process> process = std::make_unique<TinyProcessLib::Process>(
+                utils::join_backend_and_args(m_config.backend, m_config.backend_args), 
+                utils::to_wstring(m_config.backend_workdir), 
+                backend_create_stdout_function(m_config, m_logger, events), nullptr, false, process_config);
+
+            backend_worker = std::jthread([this, p=std::move(process), j=std::move(job), non_ui_mask, &w](std::stop_token st) {
+                scheduling_utils::pin_current_thread(non_ui_mask);
+                if (const auto exit = p->get_exit_status(st); exit)
+                {
+                    m_logger->log_from_bonnet(std::format("backend process exited autonomously. Exit code={}", *exit));
+                    w.terminate();
+                }
+                else
+                {
+                    m_logger->log_from_bonnet(std::format("backend process exited after bonnet sent a graceful shutdown. Exit code={}", p->ctrl_c()));
+                }
+            });
+        }
     }
 
     w.run();
@@ -349,7 +602,23 @@ bonnet::launcher bonnet::create_launcher(int argc, char** argv)
         bonnet_config.debug = result[options::debug].as<bool>();
         bonnet_config.backend_show_console = result[options::backend_show_console].as<bool>();
         bonnet_config.backend_no_log = result[options::backend_no_log].as<bool>();
+        bonnet_config.backend_events = result[options::backend_events].as<bool>();
+        bonnet_config.backend_events_prefix = result[options::backend_events_prefix].as<std::string>();
+        bonnet_config.backend_control = result[options::backend_control].as<bool>();
+        bonnet_config.backend_replicas = result[options::backend_replicas].as<size_t>();
+        bonnet_config.backend_max_in_flight = result[options::backend_max_in_flight].as<size_t>();
+        bonnet_config.backend_rpc = result[options::backend_rpc].as<std::string>();
         bonnet_config.no_log_at_all = result[options::no_log_at_all].as<bool>();
+        bonnet_config.backend_priority = utils::to_process_priority(result[options::backend_priority].as<std::string>());
+        if (result.count(options::backend_cpus))
+        {
+            bonnet_config.backend_cpus = result[options::backend_cpus].as<std::vector<int>>();
+        }
+        bonnet_config.ui_cpu = result[options::ui_cpu].as<int>();
+        bonnet_config.telemetry_buffer_kb = result[options::telemetry_buffer].as<size_t>();
+        bonnet_config.telemetry_max_batch = result[options::telemetry_max_batch].as<size_t>();
+        bonnet_config.stats_interval_s = result[options::stats_interval].as<size_t>();
+        bonnet_config.rpc_timeout_s = result[options::rpc_timeout].as<size_t>();
 
         if (result.count(options::width) && result.count(options::height))
         {
@@ -8,6 +8,14 @@
 
 namespace bonnet
 {
+	enum class process_priority
+	{
+		idle,
+		below_normal,
+		normal,
+		above_normal,
+	};
+
 	struct config
 	{
 		bool fullscreen = false;
@@ -15,6 +23,8 @@ namespace bonnet
 		bool debug = false;
 		bool backend_show_console = false;
 		bool backend_no_log = false;
+		bool backend_events = false;
+		bool backend_control = false;
 		bool no_log_at_all = false;
 		std::pair<int, int> window_size = { 700, 600};
 		std::string title = "bonnet";
@@ -22,7 +32,18 @@ namespace bonnet
 		std::string backend;
 		std::string backend_workdir;
 		std::vector<std::string> backend_args;
+		std::string backend_events_prefix;
 		std::string icon;
+		process_priority backend_priority = process_priority::normal;
+		std::vector<int> backend_cpus;
+		int ui_cpu = -1;
+		size_t backend_replicas = 1;
+		size_t backend_max_in_flight = 1;
+		std::string backend_rpc = "backend";
+		size_t telemetry_buffer_kb = 0;
+		size_t telemetry_max_batch = 1000;
+		size_t stats_interval_s = 0;
+		size_t rpc_timeout_s = 0;
 	};
 
 	struct logger_t
@@ -0,0 +1,349 @@
+#include "control.h"
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+namespace
+{
+    constexpr auto env_variable = "BONNET_CONTROL";
+    constexpr DWORD pipe_buffer_size = 64 * 1024;
+    constexpr uint32_t max_frame_size = 16 * 1024 * 1024;
+    constexpr uint32_t request_header_size = sizeof(uint32_t) + sizeof(uint8_t); // id and command
+
+    std::string pipe_name()
+    {
+        return std::format("\\\\.\\pipe\\bonnet-control-{}", GetCurrentProcessId());
+    }
+
+    HANDLE create_event(bool manual_reset)
+    {
+        return CreateEventW(nullptr, manual_reset, FALSE, nullptr);
+    }
+
+    uint32_t read_u32(const char* p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    bool is_event_type(std::string_view type)
+    {
+        return !type.empty() && std::ranges::all_of(type, [](char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == ':' || c == '.';
+        });
+    }
+
+    void append_u32(std::string& out, uint32_t value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Cancels a pending overlapped operation and waits until the system is done with it (and with its buffer)
+    void cancel_overlapped(HANDLE pipe, OVERLAPPED& overlapped)
+    {
+        DWORD transferred;
+        CancelIoEx(pipe, &overlapped);
+        GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+    }
+
+    // Waits for an overlapped operation to complete, unless stop gets signaled first (the operation is canceled)
+    bool wait_overlapped(HANDLE pipe, OVERLAPPED& overlapped, HANDLE stop, DWORD& transferred)
+    {
+        const HANDLE waiters[2]{ stop, overlapped.hEvent };
+        if (WaitForMultipleObjects(2, waiters, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+        {
+            cancel_overlapped(pipe, overlapped);
+            return false;
+        }
+        return GetOverlappedResult(pipe, &overlapped, &transferred, FALSE);
+    }
+}
+
+bonnet::control_channel::control_channel(logger logger, webview::webview& w, page_events& events, unsigned long long thread_affinity)
+    : m_logger(std::move(logger)), m_webview(w), m_events(events), m_pipe(nullptr, CloseHandle), m_stop_event(create_event(true), CloseHandle), m_reply_event(create_event(false), CloseHandle)
+{
+    if (!m_stop_event || !m_reply_event)
+    {
+        throw std::runtime_error(std::format("can't create control channel events (error={})", GetLastError()));
+    }
+    const auto name = pipe_name();
+    const auto pipe = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, pipe_buffer_size, pipe_buffer_size, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error(std::format("can't create control channel (error={})", GetLastError()));
+    }
+    m_pipe.reset(pipe); // owned from here on, so that anything below can throw
+
+    // inherited by the backend process
+    SetEnvironmentVariableA(env_variable, name.c_str());
+    m_logger->log_from_bonnet(std::format("config: control channel={}", name));
+
+    m_server = std::thread([this, thread_affinity] {
+        serve(thread_affinity);
+    });
+}
+
+bonnet::control_channel::~control_channel()
+{
+    SetEvent(m_stop_event.get());
+    m_server.join();
+}
+
+void bonnet::control_channel::serve(unsigned long long thread_affinity)
+{
+    if (thread_affinity)
+    {
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(thread_affinity));
+    }
+
+    const std::unique_ptr<void, decltype(&CloseHandle)> connect_event{ create_event(true), CloseHandle };
+    for (;;)
+    {
+        ResetEvent(connect_event.get());
+        OVERLAPPED overlapped{ .hEvent = connect_event.get() };
+        if (!ConnectNamedPipe(m_pipe.get(), &overlapped))
+        {
+            DWORD unused;
+            if (const auto error = GetLastError(); error == ERROR_IO_PENDING)
+            {
+                if (!wait_overlapped(m_pipe.get(), overlapped, m_stop_event.get(), unused))
+                {
+                    return;
+                }
+            }
+            else if (error != ERROR_PIPE_CONNECTED)
+            {
+                m_logger->log_from_bonnet(std::format("control channel: can't accept connections (error={})", error));
+                return;
+            }
+        }
+
+        m_logger->log_from_bonnet("control channel: backend connected");
+        m_input.clear();
+        {
+            std::lock_guard lock{ m_mutex };
+            ++m_connection;
+            m_replies.clear();
+        }
+        const auto go_on = serve_connection();
+        DisconnectNamedPipe(m_pipe.get());
+        if (!go_on)
+        {
+            return;
+        }
+        m_logger->log_from_bonnet("control channel: backend disconnected");
+    }
+}
+
+// Returns false when the channel is stopping.
+// A read is always outstanding, also while replies are being written: otherwise a backend that writes requests
+// without reading its replies would fill both pipe buffers and neither side could make progress
+bool bonnet::control_channel::serve_connection()
+{
+    const std::unique_ptr<void, decltype(&CloseHandle)> read_event{ create_event(true), CloseHandle };
+    const std::unique_ptr<void, decltype(&CloseHandle)> write_event{ create_event(true), CloseHandle };
+    OVERLAPPED read_overlapped{ .hEvent = read_event.get() };
+    OVERLAPPED write_overlapped{ .hEvent = write_event.get() };
+    std::vector<char> buffer(pipe_buffer_size);
+    std::string output; // the replies being written, kept until the write completes
+    auto reading = false;
+    auto writing = false;
+    // the operations still pending are canceled on the way out
+    const auto finish = [&](bool go_on) {
+        if (reading)
+        {
+            cancel_overlapped(m_pipe.get(), read_overlapped);
+        }
+        if (writing)
+        {
+            cancel_overlapped(m_pipe.get(), write_overlapped);
+        }
+        return go_on;
+    };
+    for (;;)
+    {
+        if (!reading)
+        {
+            if (!ReadFile(m_pipe.get(), buffer.data(), static_cast<DWORD>(buffer.size()), nullptr, &read_overlapped) && GetLastError() != ERROR_IO_PENDING)
+            {
+                return finish(true);
+            }
+            reading = true;
+        }
+        if (!writing)
+        {
+            {
+                std::lock_guard lock{ m_mutex };
+                if (output.empty())
+                {
+                    output.swap(m_replies);
+                }
+                else // what is left of a partial write goes first
+                {
+                    output.append(m_replies);
+                    m_replies.clear();
+                }
+            }
+            if (!output.empty())
+            {
+                if (!WriteFile(m_pipe.get(), output.data(), static_cast<DWORD>(output.size()), nullptr, &write_overlapped) && GetLastError() != ERROR_IO_PENDING)
+                {
+                    return finish(true);
+                }
+                writing = true;
+            }
+        }
+
+        // replies queued while a write is pending go with the next one
+        const HANDLE waiters[3]{ m_stop_event.get(), read_event.get(), writing ? write_event.get() : m_reply_event.get() };
+        DWORD transferred;
+        switch (WaitForMultipleObjects(3, waiters, FALSE, INFINITE))
+        {
+        case WAIT_OBJECT_0 + 1:
+            reading = false;
+            if (!GetOverlappedResult(m_pipe.get(), &read_overlapped, &transferred, FALSE))
+            {
+                return finish(true);
+            }
+            m_input.append(buffer.data(), transferred);
+            if (!parse_requests())
+            {
+                return finish(true);
+            }
+            break;
+        case WAIT_OBJECT_0 + 2:
+            if (writing)
+            {
+                writing = false;
+                if (!GetOverlappedResult(m_pipe.get(), &write_overlapped, &transferred, FALSE))
+                {
+                    return finish(true);
+                }
+                output.erase(0, transferred);
+            }
+            break;
+        default:
+            return finish(false);
+        }
+    }
+}
+
+// Extracts all the complete frames from the input and schedules their execution on the window thread
+bool bonnet::control_channel::parse_requests()
+{
+    std::vector<request> requests;
+    size_t offset = 0;
+    while (m_input.size() - offset >= sizeof(uint32_t))
+    {
+        const auto size = read_u32(m_input.data() + offset);
+        if (size < request_header_size || size > max_frame_size)
+        {
+            m_logger->log_from_bonnet(std::format("control channel: invalid frame size {}, closing connection", size));
+            return false;
+        }
+        if (m_input.size() - offset - sizeof(uint32_t) < size)
+        {
+            break;
+        }
+        const auto frame = m_input.data() + offset + sizeof(uint32_t);
+        requests.push_back({ m_connection, read_u32(frame), static_cast<command>(frame[sizeof(uint32_t)]), std::string(frame + request_header_size, size - request_header_size) });
+        offset += sizeof(uint32_t) + size;
+    }
+    m_input.erase(0, offset);
+
+    if (!requests.empty())
+    {
+        std::lock_guard lock{ m_mutex };
+        m_requests.insert(m_requests.end(), std::make_move_iterator(requests.begin()), std::make_move_iterator(requests.end()));
+        if (!std::exchange(m_execute_scheduled, true))
+        {
+            m_webview.dispatch([this] { execute_requests(); });
+        }
+    }
+    return true;
+}
+
+void bonnet::control_channel::execute_requests()
+{
+    std::vector<request> requests;
+    {
+        std::lock_guard lock{ m_mutex };
+        requests.swap(m_requests);
+        m_execute_scheduled = false;
+    }
+
+    // requests are queued in connection order: only the replies for the latest one can still be delivered
+    std::string replies;
+    uint64_t connection = 0;
+    for (const auto& r : requests)
+    {
+        const auto error = execute(r);
+        if (r.id)
+        {
+            if (r.connection != connection)
+            {
+                replies.clear();
+                connection = r.connection;
+            }
+            append_u32(replies, static_cast<uint32_t>(request_header_size + error.size()));
+            append_u32(replies, r.id);
+            replies.push_back(error.empty() ? 0 : 1);
+            replies.append(error);
+        }
+    }
+
+    if (!replies.empty())
+    {
+        std::lock_guard lock{ m_mutex };
+        if (connection == m_connection)
+        {
+            m_replies.append(replies);
+            SetEvent(m_reply_event.get());
+        }
+    }
+}
+
+// Returns the error message, empty on success
+std::string bonnet::control_channel::execute(const request& r)
+{
+    switch (r.cmd)
+    {
+    case command::navigate:
+        m_webview.navigate(r.payload);
+        return {};
+    case command::eval:
+        m_webview.eval(r.payload);
+        return {};
+    case command::set_title:
+        m_webview.set_title(r.payload);
+        return {};
+    case command::set_size:
+    {
+        int32_t size[3];
+        if (r.payload.size() != sizeof(size))
+        {
+            return "set_size: expected width, height and hints";
+        }
+        std::memcpy(size, r.payload.data(), sizeof(size));
+        m_webview.set_size(size[0], size[1], size[2]);
+        return {};
+    }
+    case command::terminate:
+        m_logger->log_from_bonnet("control channel: backend requested termination");
+        m_webview.terminate();
+        return {};
+    case command::publish:
+    {
+        const auto separator = r.payload.find('\0');
+        if (separator == std::string::npos || !is_event_type(std::string_view{ r.payload }.substr(0, separator)) || !is_json(std::string_view{ r.payload }.substr(separator + 1)))
+        {
+            return "publish: expected event type (letters, digits, '-', '_', ':', '.') and JSON detail";
+        }
+        m_events.post(r.payload.substr(0, separator), r.payload.substr(separator + 1));
+        return {};
+    }
+    default:
+        return std::format("unknown command {}", static_cast<int>(r.cmd));
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bonnet.h"
+#include "events.h"
+
+namespace bonnet
+{
+	// Local channel the backend can use to drive the window: a named pipe whose name is exported to the
+	// backend in the BONNET_CONTROL environment variable.
+	//
+	// Every message is a frame (integers are little endian):
+	//   request: u32 size (of what follows), u32 id, u8 command, payload
+	//   reply:   u32 size (of what follows), u32 id, u8 status (0 ok, 1 error), payload (error message)
+	// Requests with id 0 get no reply, so that the backend can pipeline commands without waiting.
+	// Commands received together are executed in a single dispatch on the window thread.
+	class control_channel
+	{
+	public:
+		enum class command : uint8_t
+		{
+			navigate = 1,  // payload: url
+			eval = 2,      // payload: script
+			set_title = 3, // payload: title
+			set_size = 4,  // payload: i32 width, i32 height, i32 hints (WEBVIEW_HINT_*)
+			terminate = 5, // payload: empty
+			publish = 6,   // payload: event type, '\0', JSON detail (dispatched on window like backend events)
+		};
+
+		control_channel(logger logger, webview::webview& w, page_events& events, unsigned long long thread_affinity);
+		~control_channel();
+		control_channel(const control_channel&) = delete;
+		control_channel& operator=(const control_channel&) = delete;
+	private:
+		struct request
+		{
+			uint64_t connection;
+			uint32_t id;
+			command cmd;
+			std::string payload;
+		};
+
+		void serve(unsigned long long thread_affinity);
+		bool serve_connection();
+		bool parse_requests();
+		void execute_requests();
+		std::string execute(const request& r);
+
+		logger m_logger;
+		webview::webview& m_webview;
+		page_events& m_events;
+		std::unique_ptr<void, decltype(&CloseHandle)> m_pipe;
+		std::unique_ptr<void, decltype(&CloseHandle)> m_stop_event;
+		std::unique_ptr<void, decltype(&CloseHandle)> m_reply_event;
+		std::string m_input;
+		std::mutex m_mutex;
+		std::vector<request> m_requests;
+		bool m_execute_scheduled = false;
+		uint64_t m_connection = 0; // replies to requests of a previous connection are dropped
+		std::string m_replies;
+		std::thread m_server;
+	};
+}
@@ -0,0 +1,143 @@
+#include "events.h"
+#include <format>
+#include <memory>
+#include <utility>
+
+namespace
+{
+    constexpr auto backend_event_type = "backend";
+
+    std::string_view trim(std::string_view s)
+    {
+        const auto first = s.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos)
+        {
+            return {};
+        }
+        return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    // Lives in the backend stdout reader thread only
+    class backend_line_parser
+    {
+    public:
+        backend_line_parser(std::string prefix, bonnet::logger logger, bool log_lines, bonnet::page_events& events)
+            : m_prefix(std::move(prefix)), m_logger(std::move(logger)), m_log_lines(log_lines), m_events(events)
+        {
+        }
+
+        ~backend_line_parser()
+        {
+            if (!m_partial.empty())
+            {
+                on_line(m_partial);
+            }
+        }
+
+        void feed(const char* bytes, size_t n)
+        {
+            std::string_view chunk{ bytes, n };
+            for (auto eol = chunk.find('\n'); eol != std::string_view::npos; eol = chunk.find('\n'))
+            {
+                const auto line = chunk.substr(0, eol + 1);
+                if (m_partial.empty())
+                {
+                    on_line(line);
+                }
+                else
+                {
+                    m_partial.append(line);
+                    on_line(m_partial);
+                    m_partial.clear();
+                }
+                chunk.remove_prefix(eol + 1);
+            }
+            m_partial.append(chunk);
+        }
+
+        void on_line(std::string_view line)
+        {
+            if (const auto event = as_event(line); !event.empty())
+            {
+                m_events.post(backend_event_type, std::string{ event });
+            }
+            else if (m_log_lines)
+            {
+                m_logger->log_from_process(line.data(), line.size());
+            }
+        }
+    private:
+
+        std::string_view as_event(std::string_view line) const
+        {
+            if (m_prefix.empty())
+            {
+                const auto object = trim(line);
+                return !object.empty() && object.front() == '{' && bonnet::is_json(object) ? object : std::string_view{};
+            }
+            if (!line.starts_with(m_prefix))
+            {
+                return {};
+            }
+            const auto payload = trim(line.substr(m_prefix.size()));
+            return bonnet::is_json(payload) ? payload : std::string_view{};
+        }
+
+        std::string m_prefix;
+        std::string m_partial;
+        bonnet::logger m_logger;
+        bool m_log_lines;
+        bonnet::page_events& m_events;
+    };
+}
+
+bool bonnet::is_json(std::string_view text)
+{
+    // the same parser that reads the page's messages, so that the two agree on what JSON is
+    webview::detail::json_document document;
+    return document.parse(text);
+}
+
+bonnet::page_events::page_events(webview::webview& w, logger logger)
+    : m_webview(w), m_logger(std::move(logger))
+{
+}
+
+bonnet::page_events::~page_events()
+{
+    if (const auto dropped = m_webview.dropped_dom_events())
+    {
+        m_logger->log_from_bonnet(std::format("page events: {} events dropped while the window was busy", dropped));
+    }
+}
+
+void bonnet::page_events::post(std::string type, std::string json_detail)
+{
+    m_webview.dispatch_event(std::move(type), std::move(json_detail));
+}
+
+std::function<void(const char* bytes, size_t n)> bonnet::create_backend_events_function(const config& config, logger logger, page_events& events)
+{
+    auto parser = std::make_shared<backend_line_parser>(config.backend_events_prefix, std::move(logger), !config.backend_no_log, events);
+    return [p = std::move(parser)](const char* bytes, size_t n) {
+        p->feed(bytes, n);
+    };
+}
+
+std::function<void(std::string_view line)> bonnet::create_backend_line_function(const config& config, logger logger, page_events& events)
+{
+    if (!config.backend_events)
+    {
+        if (config.backend_no_log)
+        {
+            return [](std::string_view) {};
+        }
+        return [l = std::move(logger)](std::string_view line) {
+            l->log_from_process(line.data(), line.size());
+        };
+    }
+    auto parser = std::make_shared<backend_line_parser>(config.backend_events_prefix, std::move(logger), !config.backend_no_log, events);
+    return [p = std::move(parser)](std::string_view line) {
+        p->on_line(line);
+    };
+}
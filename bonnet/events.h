@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bonnet.h"
+
+namespace bonnet
+{
+	// Delivers DOM events (dispatched on window) to the page.
+	// Events can be posted from any thread and are sent with the webview frame flush:
+	// all the events of a frame (with stream chunks and bus values) are a single message.
+	// While the window thread is busy, at most webview::max_pending_events wait: the oldest ones are dropped
+	class page_events
+	{
+	public:
+		page_events(webview::webview& w, logger logger);
+		~page_events();
+		page_events(const page_events&) = delete;
+		page_events& operator=(const page_events&) = delete;
+
+		// json_detail must be valid JSON: it becomes event.detail
+		void post(std::string type, std::string json_detail);
+	private:
+		webview::webview& m_webview;
+		logger m_logger;
+	};
+
+	// Returns true if text is a single, valid JSON value (surrounding blanks are allowed)
+	bool is_json(std::string_view text);
+
+	// Creates the backend stdout function of the events mode: output is split in lines,
+	// events are posted to the page as "backend" DOM events and any other line goes to the log
+	std::function<void(const char* bytes, size_t n)> create_backend_events_function(const config& config, logger logger, page_events& events);
+
+	// Creates the function handling whole lines of backend output that are not meant for bonnet (e.g. replica output that is
+	// not a response): in the events mode, events are posted to the page; other lines go to the log, unless disabled
+	std::function<void(std::string_view line)> create_backend_line_function(const config& config, logger logger, page_events& events);
+}
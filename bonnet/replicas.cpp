@@ -0,0 +1,288 @@
+#include "replicas.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <format>
+
+namespace
+{
+    constexpr auto replica_down_error = R"({"code":-32000,"message":"backend replica is down"})";
+    constexpr auto no_replicas_error = R"({"code":-32000,"message":"no backend replicas available"})";
+    constexpr auto invalid_call_error = R"({"code":-32600,"message":"expected method name and optional params"})";
+
+    std::vector<std::wstring> command_line(const bonnet::config& config)
+    {
+        std::vector<std::wstring> out;
+        out.emplace_back(begin(config.backend), end(config.backend));
+        for (const auto& arg : config.backend_args)
+        {
+            out.emplace_back(begin(arg), end(arg));
+        }
+        return out;
+    }
+
+    // Returns the raw JSON value of key (or of the element at index, if key is null), empty if not found
+    std::string_view json_value(std::string_view json, const char* key, size_t index = 0)
+    {
+        const char* value = nullptr;
+        size_t size = 0;
+        webview::detail::json_parse_c(json.data(), json.size(), key, key ? strlen(key) : index, &value, &size);
+        return value ? std::string_view{ value, size } : std::string_view{};
+    }
+}
+
+bonnet::replica_pool::replica_pool(const config& config, logger logger, webview::webview& w, job_handle job, TinyProcessLib::Config process_config, std::function<void(std::string_view line)> other_lines)
+    : m_logger(std::move(logger)), m_webview(w), m_other_lines(std::move(other_lines)), m_max_in_flight(std::max<size_t>(config.backend_max_in_flight, 1)), m_job(std::move(job))
+{
+    m_logger->log_from_bonnet(std::format("config: backend replicas={} max_in_flight={} rpc={}", config.backend_replicas, m_max_in_flight, config.backend_rpc));
+    for (size_t i = 0; i < config.backend_replicas; ++i)
+    {
+        start_replica(i, config, process_config);
+    }
+}
+
+bonnet::replica_pool::~replica_pool()
+{
+    m_logger->log_from_bonnet(std::format("backend replicas: {} cancelled calls dropped before being sent", m_dropped));
+    for (const auto& r : m_replicas)
+    {
+        r->monitor = {}; // sends the graceful shutdown to replicas still alive
+        m_logger->log_from_bonnet(std::format("backend replica {} served {} calls", r->index, r->served));
+    }
+}
+
+void bonnet::replica_pool::start_replica(size_t index, const config& config, const TinyProcessLib::Config& process_config)
+{
+    auto r = std::make_unique<replica>();
+    r->index = index;
+    r->process = std::make_unique<TinyProcessLib::Process>(
+        command_line(config),
+        std::wstring(begin(config.backend_workdir), end(config.backend_workdir)),
+        [this, target = r.get()](const char* bytes, size_t n) { on_output(*target, bytes, n); },
+        nullptr, true, process_config);
+    const auto target = r.get();
+    {
+        std::lock_guard lock{ m_mutex };
+        m_replicas.push_back(std::move(r));
+        ++m_alive;
+    }
+
+    target->monitor = std::jthread([this, target, affinity = process_config.reader_affinity](std::stop_token st) {
+        if (affinity)
+        {
+            SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(affinity));
+        }
+        if (const auto exit = target->process->get_exit_status(st); exit)
+        {
+            on_replica_down(*target, std::format("exited autonomously. Exit code={}", *exit));
+        }
+        else
+        {
+            m_logger->log_from_bonnet(std::format("backend replica {} exited after bonnet sent a graceful shutdown. Exit code={}", target->index, target->process->ctrl_c()));
+        }
+    });
+}
+
+void bonnet::replica_pool::call(const std::string& seq, const std::string& request, std::stop_token stop)
+{
+    const auto method = json_value(request, nullptr, 0);
+    if (method.empty() || method.front() != '"')
+    {
+        m_webview.resolve(seq, 1, invalid_call_error);
+        return;
+    }
+
+    std::vector<outgoing_line> lines;
+    {
+        std::lock_guard lock{ m_mutex };
+        if (!m_alive)
+        {
+            m_webview.resolve(seq, 1, no_replicas_error);
+            return;
+        }
+        m_queue.push_back({ seq, std::string{ method }, std::string{ json_value(request, nullptr, 1) }, std::move(stop) });
+        lines = assign_calls();
+    }
+    send(std::move(lines));
+}
+
+void bonnet::replica_pool::notify(const std::string& request)
+{
+    const auto method = json_value(request, nullptr, 0);
+    if (method.empty() || method.front() != '"')
+    {
+        return;
+    }
+
+    replica* target = nullptr;
+    {
+        std::lock_guard lock{ m_mutex };
+        for (const auto& r : m_replicas)
+        {
+            if (r->alive && (!target || r->in_flight < target->in_flight))
+            {
+                target = r.get();
+            }
+        }
+    }
+    if (!target)
+    {
+        return;
+    }
+
+    const auto params = json_value(request, nullptr, 1);
+    std::vector<outgoing_line> lines;
+    lines.push_back({ target, params.empty()
+        ? std::format(R"({{"jsonrpc":"2.0","method":{}}})" "\n", method)
+        : std::format(R"({{"jsonrpc":"2.0","method":{},"params":{}}})" "\n", method, params) });
+    send(std::move(lines));
+}
+
+// Must be called with the lock held
+std::vector<bonnet::replica_pool::outgoing_line> bonnet::replica_pool::assign_calls()
+{
+    std::vector<outgoing_line> lines;
+    // nobody is waiting for the result of the calls stopped while queued, wherever they are
+    m_dropped += std::erase_if(m_queue, [](const pending_call& call) { return call.stop.stop_requested(); });
+    while (!m_queue.empty())
+    {
+        replica* target = nullptr;
+        for (const auto& r : m_replicas)
+        {
+            if (r->alive && r->in_flight < m_max_in_flight && (!target || r->in_flight < target->in_flight))
+            {
+                target = r.get();
+            }
+        }
+        if (!target)
+        {
+            break;
+        }
+
+        auto& call = m_queue.front();
+        const auto id = m_next_id++;
+        ++target->in_flight;
+        lines.push_back({ target, call.params.empty()
+            ? std::format(R"({{"jsonrpc":"2.0","id":{},"method":{}}})" "\n", id, call.method)
+            : std::format(R"({{"jsonrpc":"2.0","id":{},"method":{},"params":{}}})" "\n", id, call.method, call.params) });
+        m_sent.emplace(id, sent_call{ std::move(call.seq), target });
+        m_queue.pop_front();
+    }
+    return lines;
+}
+
+void bonnet::replica_pool::send(std::vector<outgoing_line> lines)
+{
+    for (const auto& [target, line] : lines)
+    {
+        if (!target->process->write(line))
+        {
+            on_replica_down(*target, "can't be written");
+        }
+    }
+}
+
+// Called by the stdout reader thread of r
+void bonnet::replica_pool::on_output(replica& r, const char* bytes, size_t n)
+{
+    std::string_view chunk{ bytes, n };
+    for (auto eol = chunk.find('\n'); eol != std::string_view::npos; eol = chunk.find('\n'))
+    {
+        if (r.partial_line.empty())
+        {
+            on_line(r, chunk.substr(0, eol + 1));
+        }
+        else
+        {
+            r.partial_line.append(chunk.substr(0, eol + 1));
+            on_line(r, r.partial_line);
+            r.partial_line.clear();
+        }
+        chunk.remove_prefix(eol + 1);
+    }
+    r.partial_line.append(chunk);
+}
+
+void bonnet::replica_pool::on_line(replica& r, std::string_view line)
+{
+    const auto id_value = json_value(line, "id");
+    uint64_t id = 0;
+    if (id_value.empty() || std::from_chars(id_value.data(), id_value.data() + id_value.size(), id).ec != std::errc{})
+    {
+        m_other_lines(line); // not a response, e.g. an event
+        return;
+    }
+
+    std::string seq;
+    std::vector<outgoing_line> lines;
+    {
+        std::lock_guard lock{ m_mutex };
+        const auto it = m_sent.find(id);
+        if (it == m_sent.end() || it->second.target != &r)
+        {
+            return;
+        }
+        seq = std::move(it->second.seq);
+        m_sent.erase(it);
+        --r.in_flight;
+        ++r.served;
+        lines = assign_calls();
+    }
+
+    if (const auto error = json_value(line, "error"); !error.empty())
+    {
+        m_webview.resolve(seq, 1, std::string{ error });
+    }
+    else
+    {
+        const auto result = json_value(line, "result");
+        m_webview.resolve(seq, 0, result.empty() ? "null" : std::string{ result });
+    }
+    send(std::move(lines));
+}
+
+void bonnet::replica_pool::on_replica_down(replica& r, const std::string& reason)
+{
+    std::vector<std::string> rejected;
+    bool last = false;
+    {
+        std::lock_guard lock{ m_mutex };
+        if (!std::exchange(r.alive, false))
+        {
+            return;
+        }
+        last = --m_alive == 0;
+        for (auto it = m_sent.begin(); it != m_sent.end();)
+        {
+            if (it->second.target == &r)
+            {
+                rejected.push_back(std::move(it->second.seq));
+                it = m_sent.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        r.in_flight = 0;
+        if (last)
+        {
+            for (auto& call : m_queue)
+            {
+                rejected.push_back(std::move(call.seq));
+            }
+            m_queue.clear();
+        }
+    }
+
+    m_logger->log_from_bonnet(std::format("backend replica {} {}, {} pending calls rejected", r.index, reason, rejected.size()));
+    for (const auto& seq : rejected)
+    {
+        m_webview.resolve(seq, 1, replica_down_error);
+    }
+    if (last)
+    {
+        m_logger->log_from_bonnet("all backend replicas are down");
+        m_webview.terminate();
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "bonnet.h"
+#include "process.hpp"
+
+namespace bonnet
+{
+	// Runs N identical replicas of the backend, each one speaking line-delimited JSON-RPC 2.0
+	// over its standard input and output, and spreads calls from the page among them:
+	// a call goes to the least loaded replica that has less than max_in_flight pending calls, otherwise it waits in a queue.
+	// A replica that exits (or can't be written) leaves the pool and its pending calls are rejected.
+	// Calls the page gave up on while waiting in the queue are dropped instead of being sent.
+	// When the last replica leaves the pool, the window is closed
+	class replica_pool
+	{
+	public:
+		using job_handle = std::unique_ptr<void, decltype(&CloseHandle)>;
+
+		// other_lines gets the output lines that are not responses (e.g. events), from the reader threads
+		replica_pool(const config& config, logger logger, webview::webview& w, job_handle job, TinyProcessLib::Config process_config, std::function<void(std::string_view line)> other_lines);
+		~replica_pool();
+		replica_pool(const replica_pool&) = delete;
+		replica_pool& operator=(const replica_pool&) = delete;
+
+		// Called by the bound function: request is the JSON array [method, params]
+		void call(const std::string& seq, const std::string& request, std::stop_token stop);
+		// Called by the bound notification: sent right away (without an id) to the least loaded replica, nobody waits for a reply
+		void notify(const std::string& request);
+	private:
+		struct replica
+		{
+			size_t index = 0;
+			size_t in_flight = 0;
+			size_t served = 0;
+			bool alive = true;
+			std::string partial_line;
+			std::unique_ptr<TinyProcessLib::Process> process;
+			std::jthread monitor;
+		};
+
+		struct pending_call
+		{
+			std::string seq;
+			std::string method; // JSON string
+			std::string params; // JSON value, might be empty
+			std::stop_token stop;
+		};
+
+		struct sent_call
+		{
+			std::string seq;
+			replica* target;
+		};
+
+		struct outgoing_line
+		{
+			replica* target;
+			std::string line;
+		};
+
+		void start_replica(size_t index, const config& config, const TinyProcessLib::Config& process_config);
+		void on_output(replica& r, const char* bytes, size_t n);
+		void on_line(replica& r, std::string_view line);
+		void on_replica_down(replica& r, const std::string& reason);
+		std::vector<outgoing_line> assign_calls();
+		void send(std::vector<outgoing_line> lines);
+
+		logger m_logger;
+		webview::webview& m_webview;
+		std::function<void(std::string_view line)> m_other_lines;
+		size_t m_max_in_flight;
+		job_handle m_job;
+		std::mutex m_mutex;
+		std::deque<pending_call> m_queue;
+		std::unordered_map<uint64_t, sent_call> m_sent;
+		uint64_t m_next_id = 1;
+		size_t m_alive = 0;
+		size_t m_dropped = 0;
+		std::vector<std::unique_ptr<replica>> m_replicas;
+	};
+}
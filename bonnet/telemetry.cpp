@@ -0,0 +1,98 @@
+#include "telemetry.h"
+#include <chrono>
+#include <condition_variable>
+#include <format>
+#include <span>
+
+namespace
+{
+    constexpr auto telemetry_event_type = "telemetry";
+    constexpr auto frame_duration = std::chrono::milliseconds{ 16 };
+
+    std::string mapping_name()
+    {
+        return std::format("Local\\bonnet-telemetry-{}", GetCurrentProcessId());
+    }
+}
+
+bonnet::telemetry_channel::telemetry_channel(const config& config, logger logger, page_events& events, unsigned long long thread_affinity)
+    : m_logger(std::move(logger)), m_events(events), m_mapping(nullptr, CloseHandle), m_view(nullptr, UnmapViewOfFile)
+{
+    const auto size = telemetry::data_offset + config.telemetry_buffer_kb * 1024;
+    const auto name = mapping_name();
+    m_mapping.reset(CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name.c_str()));
+    if (!m_mapping)
+    {
+        throw std::runtime_error(std::format("can't create telemetry buffer (error={})", GetLastError()));
+    }
+    m_view.reset(MapViewOfFile(m_mapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!m_view)
+    {
+        throw std::runtime_error(std::format("can't map telemetry buffer (error={})", GetLastError()));
+    }
+    m_ring = telemetry::ring::create(m_view.get(), size);
+
+    // inherited by the backend process
+    SetEnvironmentVariableA(telemetry::env_variable, name.c_str());
+    m_logger->log_from_bonnet(std::format("config: telemetry buffer={}KB max_batch={}", config.telemetry_buffer_kb, config.telemetry_max_batch));
+
+    m_drainer = std::jthread([this, max_batch = config.telemetry_max_batch, thread_affinity](std::stop_token st) {
+        drain(st, max_batch, thread_affinity);
+    });
+}
+
+bonnet::telemetry_channel::~telemetry_channel()
+{
+    m_drainer = {}; // stop draining before unmapping
+}
+
+void bonnet::telemetry_channel::drain(std::stop_token st, size_t max_batch, unsigned long long thread_affinity)
+{
+    if (thread_affinity)
+    {
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(thread_affinity));
+    }
+
+    size_t received = 0, dropped = 0;
+    uint64_t corruptions = 0;
+    std::string batch;
+    std::mutex mutex;
+    std::condition_variable_any frame;
+    std::unique_lock lock{ mutex };
+    while (!st.stop_requested())
+    {
+        frame.wait_for(lock, st, frame_duration, [] { return false; });
+        m_ring.consume([&](std::span<const std::string_view> records) {
+            received += records.size();
+            // coalescing: when the page can't keep up, only the most recent records are delivered
+            if (max_batch && records.size() > max_batch)
+            {
+                dropped += records.size() - max_batch;
+                records = records.last(max_batch);
+            }
+            batch = "[";
+            for (const auto record : records)
+            {
+                if (is_json(record))
+                {
+                    batch.append(record).push_back(',');
+                }
+                else
+                {
+                    ++dropped;
+                }
+            }
+            if (batch.size() > 1)
+            {
+                batch.back() = ']';
+                m_events.post(telemetry_event_type, std::move(batch));
+            }
+        });
+        if (m_ring.corruptions() != corruptions)
+        {
+            corruptions = m_ring.corruptions();
+            m_logger->log_from_bonnet("telemetry: the buffer is corrupted, unread records were skipped");
+        }
+    }
+    m_logger->log_from_bonnet(std::format("telemetry: received {} records, dropped {}", received, dropped));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include "bonnet.h"
+#include "events.h"
+#include "telemetry_ring.h"
+
+namespace bonnet
+{
+	// Owns the shared memory telemetry ring (a named file mapping whose name is exported to the
+	// backend in the BONNET_TELEMETRY environment variable) and drains it once per frame:
+	// all the records received in a frame become a single "telemetry" event whose detail is the array of records
+	class telemetry_channel
+	{
+	public:
+		telemetry_channel(const config& config, logger logger, page_events& events, unsigned long long thread_affinity);
+		~telemetry_channel();
+		telemetry_channel(const telemetry_channel&) = delete;
+		telemetry_channel& operator=(const telemetry_channel&) = delete;
+	private:
+		void drain(std::stop_token st, size_t max_batch, unsigned long long thread_affinity);
+
+		logger m_logger;
+		page_events& m_events;
+		std::unique_ptr<void, decltype(&CloseHandle)> m_mapping;
+		std::unique_ptr<void, decltype(&UnmapViewOfFile)> m_view;
+		telemetry::ring m_ring;
+		std::jthread m_drainer;
+	};
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <vector>
+
+// Shared memory ring buffer used by backends to stream telemetry to the page.
+// This header does not depend on bonnet, C++ backends can include it to produce records.
+// The layout is shared with the backend process: a header followed by the data area.
+// Every record is a 32-bit length followed by the payload (a JSON value) padded to 8 bytes.
+// Only one producer (the backend) and one consumer (bonnet) are supported.
+namespace bonnet::telemetry
+{
+	inline constexpr uint32_t magic = 0x52544e42; // "BNTR"
+	inline constexpr uint32_t version = 1;
+	inline constexpr uint32_t wrap_marker = 0xffffffff;
+	inline constexpr const char* env_variable = "BONNET_TELEMETRY";
+
+	struct header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t capacity; // size of the data area, a power of two
+		alignas(64) std::atomic<uint64_t> write_index; // owned by the producer
+		alignas(64) std::atomic<uint64_t> read_index; // owned by the consumer
+	};
+	static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+	inline constexpr size_t data_offset = (sizeof(header) + 63) & ~size_t{ 63 };
+
+	class ring
+	{
+	public:
+		ring() = default;
+
+		// Formats memory (size bytes) as an empty ring: capacity is the largest power of two that fits
+		static ring create(void* memory, size_t size)
+		{
+			size_t capacity = 8;
+			while (data_offset + capacity * 2 <= size)
+			{
+				capacity *= 2;
+			}
+			auto h = new (memory) header{ magic, version, capacity };
+			h->write_index.store(0);
+			h->read_index.store(0);
+			return ring{ h, capacity };
+		}
+
+		// Attaches to a ring formatted by create, returns an invalid ring if memory is not a ring
+		static ring attach(void* memory)
+		{
+			auto h = static_cast<header*>(memory);
+			return h->magic == magic && h->version == version ? ring{ h, h->capacity } : ring{};
+		}
+
+		explicit operator bool() const
+		{
+			return m_header != nullptr;
+		}
+
+		// Producer side: returns false if the ring is full (the record is not written)
+		bool try_push(const void* payload, uint32_t size)
+		{
+			const auto record = record_size(size);
+			const auto capacity = m_capacity;
+			if (size == wrap_marker || record > capacity / 2)
+			{
+				return false;
+			}
+			auto w = m_header->write_index.load(std::memory_order_relaxed);
+			const auto r = m_header->read_index.load(std::memory_order_acquire);
+			const auto tail_room = capacity - (w & (capacity - 1));
+			const auto needed = record + (tail_room < record ? tail_room : 0);
+			if (capacity - (w - r) < needed)
+			{
+				return false;
+			}
+			if (tail_room < record)
+			{
+				std::memcpy(at(w), &wrap_marker, sizeof(wrap_marker));
+				w += tail_room;
+			}
+			std::memcpy(at(w), &size, sizeof(size));
+			std::memcpy(at(w) + sizeof(size), payload, size);
+			m_header->write_index.store(w + record, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer side: visits all the available records at once, then gives their space back to the producer.
+		// Views passed to on_records are valid only during the call. Returns the number of records consumed.
+		// The producer is not trusted: on the first record that doesn't fit between the indexes (or the data area),
+		// the records read so far are delivered, the rest is skipped and corruptions() goes up
+		template<typename OnRecords>
+		size_t consume(OnRecords on_records)
+		{
+			const auto capacity = m_capacity;
+			auto r = m_header->read_index.load(std::memory_order_relaxed);
+			const auto w = m_header->write_index.load(std::memory_order_acquire);
+			m_records.clear();
+			bool corrupted = w < r || w - r > capacity;
+			while (!corrupted && r < w)
+			{
+				const auto tail_room = capacity - (r & (capacity - 1));
+				uint32_t size;
+				std::memcpy(&size, at(r), sizeof(size));
+				if (size == wrap_marker)
+				{
+					r += tail_room;
+					corrupted = r > w;
+					continue;
+				}
+				const auto record = record_size(size);
+				if (record > capacity / 2 || record > tail_room || record > w - r)
+				{
+					corrupted = true;
+					break;
+				}
+				m_records.emplace_back(reinterpret_cast<const char*>(at(r) + sizeof(size)), size);
+				r += record;
+			}
+			if (corrupted)
+			{
+				++m_corruptions;
+				r = w;
+			}
+			if (!m_records.empty())
+			{
+				on_records(m_records);
+			}
+			m_header->read_index.store(r, std::memory_order_release);
+			return m_records.size();
+		}
+
+		// Times consume found the ring corrupted
+		uint64_t corruptions() const
+		{
+			return m_corruptions;
+		}
+	private:
+		ring(header* h, uint64_t capacity)
+			: m_header(h), m_capacity(capacity)
+		{
+		}
+
+		static uint64_t record_size(uint32_t payload_size)
+		{
+			return (sizeof(uint32_t) + uint64_t{ payload_size } + 7) & ~uint64_t{ 7 };
+		}
+
+		std::byte* at(uint64_t index) const
+		{
+			return reinterpret_cast<std::byte*>(m_header) + data_offset + (index & (m_capacity - 1));
+		}
+
+		header* m_header = nullptr;
+		uint64_t m_capacity = 0; // the header is writable by the producer, it's read once
+		std::vector<std::string_view> m_records;
+		uint64_t m_corruptions = 0;
+	};
+}
@@ -43,6 +43,12 @@ struct Config {
   /// On Windows only: controls how the window is shown.
   ShowWindow show_window{ShowWindow::show_default};
 
+  /// On Windows only: job object the process is assigned to before its main thread starts, so that the job
+  /// limits (e.g. priority class and affinity) also apply to any child process it spawns. // ilpropheta
+  void *job = nullptr;
+  /// On Windows only: affinity mask of the threads reading stdout and stderr. 0 leaves the default. // ilpropheta
+  unsigned long long reader_affinity = 0;
+
   /// Set to true to break out of flatpak sandbox by prepending all commands with `/usr/bin/flatpak-spawn --host`
   /// which will execute the command line on the host system.
   /// Requires the flatpak `org.freedesktop.Flatpak` portal to be opened for the current sandbox.
@@ -124,6 +124,8 @@ Process::id_type Process::open(const string_type &command, const string_type &pa
 #endif
 
   DWORD creation_flags = stdin_fd || stdout_fd || stderr_fd ? CREATE_NO_WINDOW : 0; // CREATE_NO_WINDOW cannot be used when stdout or stderr is redirected to parent process
+  if(config.job)
+    creation_flags |= CREATE_SUSPENDED; // ilpropheta: the process must not run (nor spawn children) before joining the job
   string_type environment_str;
   if(environment) {
 #ifdef UNICODE
@@ -148,8 +150,17 @@ Process::id_type Process::open(const string_type &command, const string_type &pa
 
   if(!bSuccess)
     return 0;
-  else
-    CloseHandle(process_info.hThread);
+
+  if(config.job) { // ilpropheta: assign to the job and then let the process start
+    if(!AssignProcessToJobObject(config.job, process_info.hProcess)) {
+      TerminateProcess(process_info.hProcess, 2);
+      CloseHandle(process_info.hThread);
+      CloseHandle(process_info.hProcess);
+      return 0;
+    }
+    ResumeThread(process_info.hThread);
+  }
+  CloseHandle(process_info.hThread);
 
   if(stdin_fd)
     *stdin_fd = stdin_wr_p.detach();
@@ -170,6 +181,8 @@ void Process::async_read() noexcept {
 
   if(stdout_fd) {
     stdout_thread = std::thread([this]() {
+      if(config.reader_affinity)
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(config.reader_affinity)); // ilpropheta
       DWORD n;
       std::unique_ptr<char[]> buffer(new char[config.buffer_size]);
       for(;;) {
@@ -182,6 +195,8 @@ void Process::async_read() noexcept {
   }
   if(stderr_fd) {
     stderr_thread = std::thread([this]() {
+      if(config.reader_affinity)
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(config.reader_affinity)); // ilpropheta
       DWORD n;
       std::unique_ptr<char[]> buffer(new char[config.buffer_size]);
       for(;;) {
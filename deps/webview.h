@@ -151,17 +151,48 @@ WEBVIEW_API void webview_return(webview_t w, const char *seq, int status,
   WEBVIEW_DEPRECATED("Private API should not be used")
 #endif
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <cstddef>
 #include <cstring>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
 namespace webview {
 
 using dispatch_fn_t = std::function<void()>;
@@ -307,64 +338,424 @@ inline int json_parse_c(const char *s, size_t sz, const char *key, size_t keysz,
   return -1;
 }
 
-inline std::string json_escape(const std::string &s) {
-  // TODO: implement
-  return '"' + s + '"';
+// ilpropheta: SIMD helpers of the JSON functions below
+namespace json_simd {
+
+// One bit per byte of a 64 bytes block
+struct block_masks {
+  uint64_t quote = 0;
+  uint64_t backslash = 0;
+  uint64_t op = 0;      // { } [ ] : ,
+  uint64_t blank = 0;   // space, \t, \n, \r
+  uint64_t control = 0; // < 0x20
+};
+
+#if defined(__AVX2__)
+inline block_masks classify(const char *p) {
+  block_masks m;
+  for (int half = 0; half < 2; ++half) {
+    const auto v = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(p + static_cast<ptrdiff_t>(32 * half)));
+    const auto shift = 32 * half;
+    auto eq = [&](char c) {
+      return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+    };
+    auto bits = [&](__m256i x) {
+      return static_cast<uint64_t>(
+                 static_cast<uint32_t>(_mm256_movemask_epi8(x)))
+             << shift;
+    };
+    m.quote |= bits(eq('"'));
+    m.backslash |= bits(eq('\\'));
+    m.op |= bits(_mm256_or_si256(
+        _mm256_or_si256(_mm256_or_si256(eq('{'), eq('}')),
+                        _mm256_or_si256(eq('['), eq(']'))),
+        _mm256_or_si256(eq(':'), eq(','))));
+    m.blank |= bits(_mm256_or_si256(_mm256_or_si256(eq(' '), eq('\t')),
+                                    _mm256_or_si256(eq('\n'), eq('\r'))));
+    const auto limit = _mm256_set1_epi8(0x1f);
+    m.control |= bits(_mm256_cmpeq_epi8(_mm256_max_epu8(v, limit), limit));
+  }
+  return m;
+}
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+inline block_masks classify(const char *p) {
+  block_masks m;
+  for (int quarter = 0; quarter < 4; ++quarter) {
+    const auto v = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(p + static_cast<ptrdiff_t>(16 * quarter)));
+    const auto shift = 16 * quarter;
+    auto eq = [&](char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); };
+    auto bits = [&](__m128i x) {
+      return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(x)))
+             << shift;
+    };
+    m.quote |= bits(eq('"'));
+    m.backslash |= bits(eq('\\'));
+    m.op |= bits(_mm_or_si128(_mm_or_si128(_mm_or_si128(eq('{'), eq('}')),
+                                           _mm_or_si128(eq('['), eq(']'))),
+                              _mm_or_si128(eq(':'), eq(','))));
+    m.blank |= bits(_mm_or_si128(_mm_or_si128(eq(' '), eq('\t')),
+                                 _mm_or_si128(eq('\n'), eq('\r'))));
+    const auto limit = _mm_set1_epi8(0x1f);
+    m.control |= bits(_mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit));
+  }
+  return m;
+}
+#elif defined(__aarch64__) || defined(_M_ARM64)
+inline uint64_t neon_movemask(uint8x16_t x) {
+  const uint8x16_t weights = {1, 2, 4, 8, 16, 32, 64, 128,
+                              1, 2, 4, 8, 16, 32, 64, 128};
+  auto t = vandq_u8(x, weights);
+  t = vpaddq_u8(t, t);
+  t = vpaddq_u8(t, t);
+  t = vpaddq_u8(t, t);
+  return vgetq_lane_u16(vreinterpretq_u16_u8(t), 0);
 }
 
-inline int json_unescape(const char *s, size_t n, char *out) {
-  int r = 0;
-  if (*s++ != '"') {
-    return -1;
+inline block_masks classify(const char *p) {
+  block_masks m;
+  for (int quarter = 0; quarter < 4; ++quarter) {
+    const auto v =
+        vld1q_u8(reinterpret_cast<const uint8_t *>(p + 16 * quarter));
+    const auto shift = 16 * quarter;
+    auto eq = [&](char c) {
+      return vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(c)));
+    };
+    auto bits = [&](uint8x16_t x) { return neon_movemask(x) << shift; };
+    m.quote |= bits(eq('"'));
+    m.backslash |= bits(eq('\\'));
+    m.op |= bits(vorrq_u8(vorrq_u8(vorrq_u8(eq('{'), eq('}')),
+                                   vorrq_u8(eq('['), eq(']'))),
+                          vorrq_u8(eq(':'), eq(','))));
+    m.blank |= bits(vorrq_u8(vorrq_u8(eq(' '), eq('\t')),
+                             vorrq_u8(eq('\n'), eq('\r'))));
+    m.control |= bits(vcltq_u8(v, vdupq_n_u8(0x20)));
   }
-  while (n > 2) {
-    char c = *s;
-    if (c == '\\') {
-      s++;
-      n--;
-      switch (*s) {
-      case 'b':
-        c = '\b';
-        break;
-      case 'f':
-        c = '\f';
-        break;
-      case 'n':
-        c = '\n';
+  return m;
+}
+#else
+inline block_masks classify(const char *p) {
+  block_masks m;
+  for (int i = 0; i < 64; ++i) {
+    const auto c = static_cast<unsigned char>(p[i]);
+    const auto bit = uint64_t{1} << i;
+    switch (c) {
+    case '"':
+      m.quote |= bit;
+      break;
+    case '\\':
+      m.backslash |= bit;
+      break;
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+      m.op |= bit;
+      break;
+    case ' ':
+      m.blank |= bit;
+      break;
+    case '\t':
+    case '\n':
+    case '\r':
+      m.blank |= bit;
+      m.control |= bit;
+      break;
+    default:
+      if (c < 0x20) {
+        m.control |= bit;
+      }
+    }
+  }
+  return m;
+}
+#endif
+
+// Bit i of the result is the xor of bits 0..i of x
+inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Position of the first byte of s that json_escape can't copy as it is: a
+// quote, a backslash, a control character or 0xE2 (first byte of U+2028 and
+// U+2029 in UTF-8). Returns s.size() if there are none
+inline size_t find_escape(std::string_view s) {
+  const auto p = s.data();
+  const auto n = s.size();
+  size_t i = 0;
+#if defined(__AVX2__)
+  const auto limit = _mm256_set1_epi8(0x1f);
+  for (; i + 32 <= n; i += 32) {
+    const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    const auto special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, limit), limit),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(static_cast<char>(0xe2)))));
+    if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special))) {
+      return i + std::countr_zero(mask);
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  const auto limit = _mm_set1_epi8(0x1f);
+  for (; i + 16 <= n; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    const auto special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(0xe2)))));
+    if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special))) {
+      return i + std::countr_zero(mask);
+    }
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  for (; i + 16 <= n; i += 16) {
+    const auto v = vld1q_u8(reinterpret_cast<const uint8_t *>(p + i));
+    const auto special =
+        vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')),
+                          vceqq_u8(v, vdupq_n_u8('\\'))),
+                 vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)),
+                          vceqq_u8(v, vdupq_n_u8(0xe2))));
+    if (const auto mask = neon_movemask(special)) {
+      return i + std::countr_zero(mask);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    const auto c = static_cast<unsigned char>(p[i]);
+    if (c == '"' || c == '\\' || c < 0x20 || c == 0xe2) {
+      return i;
+    }
+  }
+  return n;
+}
+
+} // namespace json_simd
+
+// ilpropheta: appends s to out as a JSON string (quotes included). Besides
+// quotes, backslashes and control characters, U+2028 and U+2029 are escaped
+// too: they are line terminators for JavaScript engines predating ES2019, and
+// the result usually ends up in an eval. Clean runs are copied in bulk
+inline void json_escape(std::string_view s, std::string &out) {
+  constexpr char hex[] = "0123456789abcdef";
+  auto special = [](unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20 || c == 0xe2;
+  };
+  out.reserve(out.size() + s.size() + 2);
+  out.push_back('"');
+  for (;;) {
+    const auto clean = json_simd::find_escape(s);
+    out.append(s.data(), clean);
+    if (clean == s.size()) {
+      break;
+    }
+    // escape-heavy inputs: consecutive special bytes are handled here,
+    // without going back to the vector scan
+    auto i = clean;
+    do {
+      const auto c = static_cast<unsigned char>(s[i++]);
+      char escape = 0;
+      switch (c) {
+      case '"':
+      case '\\':
+        escape = static_cast<char>(c);
         break;
-      case 'r':
-        c = '\r';
+      case '\b':
+        escape = 'b';
         break;
-      case 't':
-        c = '\t';
+      case '\f':
+        escape = 'f';
         break;
-      case '\\':
-        c = '\\';
+      case '\n':
+        escape = 'n';
         break;
-      case '/':
-        c = '/';
+      case '\r':
+        escape = 'r';
         break;
-      case '\"':
-        c = '\"';
+      case '\t':
+        escape = 't';
         break;
-      default: // TODO: support unicode decoding
-        return -1;
+      case 0xe2:
+        if (s.size() - i >= 2 && s[i] == '\x80' &&
+            (s[i + 1] == '\xa8' || s[i + 1] == '\xa9')) {
+          out.append(s[i + 1] == '\xa8' ? "\\u2028" : "\\u2029", 6);
+          i += 2;
+        } else {
+          out.push_back(static_cast<char>(c));
+        }
+        continue;
+      default: {
+        const char unicode[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        out.append(unicode, sizeof(unicode));
+        continue;
+      }
+      }
+      const char pair[] = {'\\', escape};
+      out.append(pair, sizeof(pair));
+    } while (i < s.size() && special(static_cast<unsigned char>(s[i])));
+    s.remove_prefix(i);
+  }
+  out.push_back('"');
+}
+
+inline std::string json_escape(const std::string &s) {
+  std::string out;
+  out.reserve(s.size() + 2);
+  json_escape(s, out);
+  return out;
+}
+
+// ilpropheta: decodes the JSON string s (quotes included) in one pass,
+// including \uXXXX escapes and surrogate pairs (lone surrogates become
+// U+FFFD). Writes the content and a terminating '\0' to out, if not NULL,
+// which needs at most n bytes: decoding never grows. Returns the size of the
+// content, -1 if s is not a valid JSON string
+inline int json_unescape(const char *s, size_t n, char *out) {
+  if (n < 2 || s[0] != '"' || s[n - 1] != '"') {
+    return -1;
+  }
+  auto hex4 = [](const char *p, uint32_t &value) {
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+      const auto c = p[i];
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= static_cast<uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        value |= static_cast<uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        value |= static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
       }
     }
+    return true;
+  };
+  size_t r = 0;
+  auto put = [&](uint32_t c) {
     if (out != NULL) {
-      *out++ = c;
+      out[r] = static_cast<char>(c);
     }
-    s++;
-    n--;
     r++;
-  }
-  if (*s != '"') {
-    return -1;
+  };
+  const char *end = s + n - 1; // closing quote
+  s++;
+  while (s < end) {
+    // runs without escapes are copied in bulk
+    const auto *backslash =
+        static_cast<const char *>(memchr(s, '\\', (size_t)(end - s)));
+    const auto clean = (size_t)((backslash != NULL ? backslash : end) - s);
+    if (out != NULL) {
+      memcpy(out + r, s, clean);
+    }
+    r += clean;
+    s += clean;
+    if (s == end) {
+      break;
+    }
+    if (end - s < 2) { // the closing quote is escaped
+      return -1;
+    }
+    const char e = s[1];
+    s += 2;
+    switch (e) {
+    case 'b':
+      put('\b');
+      break;
+    case 'f':
+      put('\f');
+      break;
+    case 'n':
+      put('\n');
+      break;
+    case 'r':
+      put('\r');
+      break;
+    case 't':
+      put('\t');
+      break;
+    case '\\':
+    case '/':
+    case '"':
+      put(static_cast<unsigned char>(e));
+      break;
+    case 'u': {
+      uint32_t cp;
+      if (end - s < 4 || !hex4(s, cp)) {
+        return -1;
+      }
+      s += 4;
+      if (cp >= 0xd800 && cp <= 0xdbff) {
+        uint32_t low;
+        if (end - s >= 6 && s[0] == '\\' && s[1] == 'u' && hex4(s + 2, low) &&
+            low >= 0xdc00 && low <= 0xdfff) {
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          s += 6;
+        } else {
+          cp = 0xfffd;
+        }
+      } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+        cp = 0xfffd;
+      }
+      if (cp < 0x80) {
+        put(cp);
+      } else if (cp < 0x800) {
+        put(0xc0 | (cp >> 6));
+        put(0x80 | (cp & 0x3f));
+      } else if (cp < 0x10000) {
+        put(0xe0 | (cp >> 12));
+        put(0x80 | ((cp >> 6) & 0x3f));
+        put(0x80 | (cp & 0x3f));
+      } else {
+        put(0xf0 | (cp >> 18));
+        put(0x80 | ((cp >> 12) & 0x3f));
+        put(0x80 | ((cp >> 6) & 0x3f));
+        put(0x80 | (cp & 0x3f));
+      }
+      break;
+    }
+    default:
+      return -1;
+    }
   }
   if (out != NULL) {
-    *out = '\0';
+    out[r] = '\0';
+  }
+  return static_cast<int>(r);
+}
+
+// ilpropheta: appends the content of the JSON string s (quotes included) to
+// out, decoding straight into its buffer
+inline bool json_unescape(std::string_view s, std::string &out) {
+  const auto size = out.size();
+  out.resize(size + s.size());
+  const auto n = json_unescape(s.data(), s.size(), out.data() + size);
+  out.resize(n < 0 ? size : size + static_cast<size_t>(n));
+  return n >= 0;
+}
+
+// ilpropheta: zero-copy fast path, the content of the JSON string s (quotes
+// included) if it has no escape sequences
+inline bool json_unquote(std::string_view s, std::string_view &out) {
+  if (s.size() < 2 || s.front() != '"' || s.back() != '"' ||
+      s.find('\\') != std::string_view::npos) {
+    return false;
   }
-  return r;
+  out = s.substr(1, s.size() - 2);
+  return true;
 }
 
 inline std::string json_parse(const std::string &s, const std::string &key,
@@ -381,1207 +772,5352 @@ inline std::string json_parse(const std::string &s, const std::string &key,
     if (value[0] != '"') {
       return std::string(value, value_sz);
     }
-    int n = json_unescape(value, value_sz, nullptr);
-    if (n > 0) {
-      char *decoded = new char[n + 1];
-      json_unescape(value, value_sz, decoded);
-      std::string result(decoded, n);
-      delete[] decoded;
+    const std::string_view raw(value, value_sz);
+    std::string_view content;
+    if (json_unquote(raw, content)) {
+      return std::string(content);
+    }
+    std::string result;
+    if (json_unescape(raw, result)) {
       return result;
     }
   }
   return "";
 }
 
-} // namespace detail
+// ilpropheta: single-pass decoding of RPC messages. Unlike json_parse, which
+// rescans the message for every key, rpc_decode visits each byte once and
+// returns views into the original message.
+struct rpc_message {
+  std::string_view id;     // raw JSON value, empty for notifications
+  std::string_view method; // raw JSON string (quotes included)
+  std::string_view params; // raw JSON value, empty if missing
+};
 
-WEBVIEW_DEPRECATED_PRIVATE
-inline int json_parse_c(const char *s, size_t sz, const char *key, size_t keysz,
-                        const char **value, size_t *valuesz) {
-  return detail::json_parse_c(s, sz, key, keysz, value, valuesz);
+// Returns the size of the JSON value at the beginning of s, 0 if it is not a
+// well-formed value (only the structure is checked, not literals and numbers)
+inline size_t json_value_size(std::string_view s) {
+  if (s.empty()) {
+    return 0;
+  }
+  size_t i = 0;
+  int depth = 0;
+  do {
+    switch (s[i]) {
+    case '"':
+      for (++i; i < s.size() && s[i] != '"'; ++i) {
+        if (s[i] == '\\') {
+          ++i;
+        }
+      }
+      if (i >= s.size()) {
+        return 0;
+      }
+      ++i;
+      break;
+    case '{':
+    case '[':
+      ++depth;
+      ++i;
+      break;
+    case '}':
+    case ']':
+      if (--depth < 0) {
+        return 0;
+      }
+      ++i;
+      break;
+    default:
+      if (depth == 0) {
+        while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ']' &&
+               s[i] != ' ' && s[i] != '\t' && s[i] != '\n' && s[i] != '\r') {
+          ++i;
+        }
+        return i;
+      }
+      ++i;
+    }
+  } while (depth > 0 && i < s.size());
+  return depth == 0 ? i : 0;
 }
 
-WEBVIEW_DEPRECATED_PRIVATE
-inline std::string json_escape(const std::string &s) {
-  return detail::json_escape(s);
+inline bool rpc_decode(std::string_view msg, rpc_message &out) {
+  out = {};
+  constexpr std::string_view blanks = " \t\n\r";
+  auto skip = [&](size_t i) {
+    const auto next = msg.find_first_not_of(blanks, i);
+    return next == std::string_view::npos ? msg.size() : next;
+  };
+  auto i = skip(0);
+  if (i >= msg.size() || msg[i] != '{') {
+    return false;
+  }
+  i = skip(i + 1);
+  while (i < msg.size() && msg[i] != '}') {
+    const auto key_size = json_value_size(msg.substr(i));
+    if (key_size < 2 || msg[i] != '"') {
+      return false;
+    }
+    const auto key = msg.substr(i + 1, key_size - 2);
+    i = skip(i + key_size);
+    if (i >= msg.size() || msg[i] != ':') {
+      return false;
+    }
+    i = skip(i + 1);
+    const auto value_size = json_value_size(msg.substr(i));
+    if (value_size == 0) {
+      return false;
+    }
+    const auto value = msg.substr(i, value_size);
+    if (key == "id") {
+      out.id = value;
+    } else if (key == "method") {
+      out.method = value;
+    } else if (key == "params") {
+      out.params = value;
+    }
+    i = skip(i + value_size);
+    if (i < msg.size() && msg[i] == ',') {
+      i = skip(i + 1);
+    }
+  }
+  return i < msg.size() && out.method.size() >= 2 &&
+         out.method.front() == '"';
 }
 
-WEBVIEW_DEPRECATED_PRIVATE
-inline int json_unescape(const char *s, size_t n, char *out) {
-  return detail::json_unescape(s, n, out);
+// ilpropheta: structural-index JSON parser for binding arguments.
+//
+// Parsing happens in two stages. The first one classifies 64 bytes at a time
+// with SIMD (AVX2, SSE2 or NEON, with a scalar fallback) into bit masks and
+// records the position of every structural character ({}[]:,), of every
+// unescaped quote and of the first byte of every literal. The second one walks
+// the positions once, checks the grammar and builds a tape of nodes: each node
+// knows where its value is and where the next sibling is, and containers keep
+// a table of their children, so that already-indexed elements are reached in
+// O(1) and values are decoded only when asked for (on demand).
+
+// Whether the backslash before pos starts a valid escape sequence
+inline bool json_is_escape(std::string_view json, size_t pos) {
+  if (pos >= json.size()) {
+    return false;
+  }
+  switch (json[pos]) {
+  case '"':
+  case '\\':
+  case '/':
+  case 'b':
+  case 'f':
+  case 'n':
+  case 'r':
+  case 't':
+    return true;
+  case 'u':
+    return pos + 4 < json.size() &&
+           std::all_of(json.begin() + pos + 1, json.begin() + pos + 5,
+                       [](char c) {
+                         return (c >= '0' && c <= '9') ||
+                                (c >= 'a' && c <= 'f') ||
+                                (c >= 'A' && c <= 'F');
+                       });
+  default:
+    return false;
+  }
 }
 
-WEBVIEW_DEPRECATED_PRIVATE
-inline std::string json_parse(const std::string &s, const std::string &key,
-                              const int index) {
-  return detail::json_parse(s, key, index);
+// Stage 1: fills index with the positions of structural characters, quotes
+// and literals. Fails on unterminated strings, control characters inside
+// strings and invalid escape sequences
+inline bool json_build_index(std::string_view json,
+                             std::vector<uint32_t> &index) {
+  index.clear();
+  if (json.size() >= UINT32_MAX) {
+    return false;
+  }
+  index.reserve(json.size() / 4 + 1);
+  uint64_t prev_escaped = 0;   // the first byte of the block is escaped
+  uint64_t prev_in_string = 0; // all ones if the block starts in a string
+  uint64_t prev_literal = 0;   // the last byte of the last block is a literal
+  uint64_t control_in_string = 0;
+  for (size_t base = 0; base < json.size(); base += 64) {
+    const char *p = json.data() + base;
+    char tail[64];
+    if (json.size() - base < 64) {
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, p, json.size() - base);
+      p = tail;
+    }
+    const auto m = json_simd::classify(p);
+
+    // a character is escaped when it follows an odd sequence of backslashes;
+    // backslashes are rare, so they are just visited one at a time
+    uint64_t escaped = prev_escaped;
+    uint64_t backslash = m.backslash & ~prev_escaped;
+    prev_escaped = 0;
+    while (backslash) {
+      const auto i = std::countr_zero(backslash);
+      if (!json_is_escape(json, base + i + 1)) {
+        return false;
+      }
+      if (i == 63) {
+        prev_escaped = 1;
+        break;
+      }
+      escaped |= uint64_t{2} << i;
+      backslash &= ~(uint64_t{3} << i);
+    }
+
+    const auto quote = m.quote & ~escaped;
+    // set from an opening quote (included) to the closing one (excluded)
+    const auto in_string = json_simd::prefix_xor(quote) ^ prev_in_string;
+    prev_in_string =
+        static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+    control_in_string |= m.control & in_string;
+
+    const auto literal = ~(m.op | m.blank | quote | in_string);
+    const auto literal_start = literal & ~((literal << 1) | prev_literal);
+    prev_literal = literal >> 63;
+
+    auto structurals = (m.op & ~in_string) | quote | literal_start;
+    while (structurals) {
+      index.push_back(
+          static_cast<uint32_t>(base + std::countr_zero(structurals)));
+      structurals &= structurals - 1;
+    }
+  }
+  return !prev_in_string && !control_in_string;
 }
 
-} // namespace webview
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+inline bool json_is_number(std::string_view s) {
+  size_t i = 0;
+  auto digits = [&] {
+    const auto start = i;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') {
+      ++i;
+    }
+    return i > start;
+  };
+  if (i < s.size() && s[i] == '-') {
+    ++i;
+  }
+  if (i < s.size() && s[i] == '0') {
+    ++i;
+  } else if (!digits()) {
+    return false;
+  }
+  if (i < s.size() && s[i] == '.') {
+    ++i;
+    if (!digits()) {
+      return false;
+    }
+  }
+  if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+    ++i;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-')) {
+      ++i;
+    }
+    if (!digits()) {
+      return false;
+    }
+  }
+  return i == s.size();
+}
 
-#if 0 // defined(WEBVIEW_GTK)
-//
-// ====================================================================
-//
-// This implementation uses webkit2gtk backend. It requires gtk+3.0 and
-// webkit2gtk-4.0 libraries. Proper compiler flags can be retrieved via:
-//
-//   pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0
-//
-// ====================================================================
-//
-#include <JavaScriptCore/JavaScript.h>
-#include <gtk/gtk.h>
-#include <webkit2/webkit2.h>
+enum class json_type : uint8_t { null, boolean, number, string, array, object };
 
-namespace webview {
-namespace detail {
+class json_document;
 
-class gtk_webkit_engine {
+// Lightweight handle to a value of a json_document (which must outlive it).
+// Accessing a missing element returns an invalid value, so lookups can be
+// chained and checked once at the end
+class json_value {
 public:
-  gtk_webkit_engine(bool debug, void *window)
-      : m_window(static_cast<GtkWidget *>(window)) {
-    if (gtk_init_check(0, NULL) == FALSE) {
-      return;
-    }
-    m_window = static_cast<GtkWidget *>(window);
-    if (m_window == nullptr) {
-      m_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  json_value() = default;
+
+  bool valid() const { return m_doc != nullptr; }
+  explicit operator bool() const { return valid(); }
+
+  json_type type() const;
+  bool is_null() const { return valid() && type() == json_type::null; }
+  // Raw JSON text of the value (quotes included for strings)
+  std::string_view raw() const;
+  // Number of elements of an array or members of an object
+  size_t size() const;
+
+  // i-th element of an array (or value of the i-th member of an object)
+  json_value operator[](size_t i) const;
+  // Value of the (first) member named key; key is compared with the raw,
+  // still escaped, name
+  json_value operator[](std::string_view key) const;
+  // Name of the i-th member of an object (raw, still escaped)
+  std::string_view key(size_t i) const;
+
+  bool get(bool &out) const;
+  bool get(std::string &out) const;
+  // Content of a string without escape sequences, no copies
+  bool get(std::string_view &out) const;
+  template <typename T,
+            std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                             int> = 0>
+  bool get(T &out) const {
+    if (!valid() || type() != json_type::number) {
+      return false;
     }
-    g_signal_connect(G_OBJECT(m_window), "destroy",
-                     G_CALLBACK(+[](GtkWidget *, gpointer arg) {
-                       static_cast<gtk_webkit_engine *>(arg)->terminate();
-                     }),
-                     this);
-    // Initialize webview widget
-    m_webview = webkit_web_view_new();
-    WebKitUserContentManager *manager =
-        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
-    g_signal_connect(manager, "script-message-received::external",
-                     G_CALLBACK(+[](WebKitUserContentManager *,
-                                    WebKitJavascriptResult *r, gpointer arg) {
-                       auto *w = static_cast<gtk_webkit_engine *>(arg);
-                       char *s = get_string_from_js_result(r);
-                       w->on_message(s);
-                       g_free(s);
-                     }),
-                     this);
-    webkit_user_content_manager_register_script_message_handler(manager,
-                                                                "external");
-    init("window.external={invoke:function(s){window.webkit.messageHandlers."
-         "external.postMessage(s);}}");
+    const auto s = raw();
+    const auto r = std::from_chars(s.data(), s.data() + s.size(), out);
+    return r.ec == std::errc{} && r.ptr == s.data() + s.size();
+  }
 
-    gtk_container_add(GTK_CONTAINER(m_window), GTK_WIDGET(m_webview));
-    gtk_widget_grab_focus(GTK_WIDGET(m_webview));
+private:
+  friend class json_document;
+  json_value(const json_document *doc, uint32_t node)
+      : m_doc(doc), m_node(node) {}
 
-    WebKitSettings *settings =
-        webkit_web_view_get_settings(WEBKIT_WEB_VIEW(m_webview));
-    webkit_settings_set_javascript_can_access_clipboard(settings, true);
-    if (debug) {
-      webkit_settings_set_enable_write_console_messages_to_stdout(settings,
-                                                                  true);
-      webkit_settings_set_enable_developer_extras(settings, true);
-    }
+  const json_document *m_doc = nullptr;
+  uint32_t m_node = 0;
+};
 
-    gtk_widget_show_all(m_window);
-  }
-  virtual ~gtk_webkit_engine() = default;
-  void *window() { return (void *)m_window; }
-  void run() { gtk_main(); }
-  void terminate() { gtk_main_quit(); }
-  void dispatch(std::function<void()> f) {
-    g_idle_add_full(G_PRIORITY_HIGH_IDLE, (GSourceFunc)([](void *f) -> int {
-                      (*static_cast<dispatch_fn_t *>(f))();
-                      return G_SOURCE_REMOVE;
-                    }),
-                    new std::function<void()>(f),
-                    [](void *f) { delete static_cast<dispatch_fn_t *>(f); });
+// Parsed JSON text: parse() indexes the whole text once, values are then
+// accessed (and decoded) through json_value handles. The text is not copied
+// and must outlive the document
+class json_document {
+public:
+  json_document() = default;
+  json_document(const json_document &) = delete;
+  json_document &operator=(const json_document &) = delete;
+
+  // Returns false (and an invalid root) if the text is not valid JSON.
+  // A document can be reused to parse other texts without reallocating
+  bool parse(std::string_view json) {
+    m_json = json;
+    m_nodes.clear();
+    m_children.clear();
+    if (!json_build_index(json, m_index) || !build_tape()) {
+      m_nodes.clear();
+      return false;
+    }
+    return true;
   }
 
-  void set_title(const std::string &title) {
-    gtk_window_set_title(GTK_WINDOW(m_window), title.c_str());
+  json_value root() const {
+    return m_nodes.empty() ? json_value{} : json_value{this, 0};
   }
 
-  void set_size(int width, int height, int hints) {
-    gtk_window_set_resizable(GTK_WINDOW(m_window), hints != WEBVIEW_HINT_FIXED);
-    if (hints == WEBVIEW_HINT_NONE) {
-      gtk_window_resize(GTK_WINDOW(m_window), width, height);
-    } else if (hints == WEBVIEW_HINT_FIXED) {
-      gtk_widget_set_size_request(m_window, width, height);
-    } else {
-      GdkGeometry g;
-      g.min_width = g.max_width = width;
-      g.min_height = g.max_height = height;
-      GdkWindowHints h =
-          (hints == WEBVIEW_HINT_MIN ? GDK_HINT_MIN_SIZE : GDK_HINT_MAX_SIZE);
-      // This defines either MIN_SIZE, or MAX_SIZE, but not both:
-      gtk_window_set_geometry_hints(GTK_WINDOW(m_window), nullptr, &g, h);
+private:
+  friend class json_value;
+
+  struct node {
+    uint32_t offset; // of the first byte of the value
+    uint32_t size;   // of the raw value
+    uint32_t next;   // node following this value and its children
+    uint32_t count;  // containers: elements or members
+    uint32_t first;  // containers: position of the first child in m_children
+    json_type type;
+  };
+
+  static constexpr size_t max_depth = 1024;
+
+  bool build_tape() {
+    const auto &index = m_index;
+    const auto n = index.size();
+    std::vector<uint32_t> open; // containers not closed yet
+    auto at = [&](size_t k) { return m_json[index[k]]; };
+    // arrays count their elements, objects their keys
+    auto add = [&](json_type type, uint32_t offset, uint32_t size) {
+      if (!open.empty() && m_nodes[open.back()].type == json_type::array) {
+        ++m_nodes[open.back()].count;
+      }
+      const auto id = static_cast<uint32_t>(m_nodes.size());
+      m_nodes.push_back({offset, size, id + 1, 0, 0, type});
+      return id;
+    };
+    auto add_string = [&](size_t k) {
+      // opening and closing quotes are consecutive positions
+      if (k + 1 >= n || at(k) != '"' || at(k + 1) != '"') {
+        return false;
+      }
+      add(json_type::string, index[k], index[k + 1] - index[k] + 1);
+      return true;
+    };
+    auto add_key = [&](size_t k) {
+      if (!add_string(k)) {
+        return false;
+      }
+      ++m_nodes[open.back()].count;
+      return k + 2 < n && at(k + 2) == ':';
+    };
+
+    size_t k = 0;
+    for (;;) {
+      // a value
+      if (k >= n) {
+        return false;
+      }
+      const auto c = at(k);
+      if (c == '{' || c == '[') {
+        if (open.size() == max_depth) {
+          return false;
+        }
+        open.push_back(add(c == '{' ? json_type::object : json_type::array,
+                           index[k], 0));
+        ++k;
+        if (k < n && at(k) == (c == '{' ? '}' : ']')) {
+          // empty container, closed below
+        } else if (c == '{') {
+          if (!add_key(k)) {
+            return false;
+          }
+          k += 3;
+          continue;
+        } else {
+          continue;
+        }
+      } else if (c == '"') {
+        if (!add_string(k)) {
+          return false;
+        }
+        k += 2;
+      } else if (c == '}' || c == ']' || c == ':' || c == ',') {
+        return false;
+      } else {
+        auto end = k + 1 < n ? index[k + 1] : m_json.size();
+        while (end > index[k] && (m_json[end - 1] == ' ' ||
+                                  m_json[end - 1] == '\t' ||
+                                  m_json[end - 1] == '\n' ||
+                                  m_json[end - 1] == '\r')) {
+          --end;
+        }
+        const auto text = m_json.substr(index[k], end - index[k]);
+        json_type type;
+        if (text == "null") {
+          type = json_type::null;
+        } else if (text == "true" || text == "false") {
+          type = json_type::boolean;
+        } else if (json_is_number(text)) {
+          type = json_type::number;
+        } else {
+          return false;
+        }
+        add(type, index[k], static_cast<uint32_t>(text.size()));
+        ++k;
+      }
+
+      // after a value: closes containers until a comma
+      for (;;) {
+        if (open.empty()) {
+          if (k != n) {
+            return false;
+          }
+          build_children();
+          return true;
+        }
+        if (k >= n) {
+          return false;
+        }
+        auto &container = m_nodes[open.back()];
+        const auto object = container.type == json_type::object;
+        if (at(k) == (object ? '}' : ']')) {
+          container.size = index[k] - container.offset + 1;
+          container.next = static_cast<uint32_t>(m_nodes.size());
+          open.pop_back();
+          ++k;
+          continue;
+        }
+        if (at(k) != ',') {
+          return false;
+        }
+        ++k;
+        if (object) {
+          if (!add_key(k)) {
+            return false;
+          }
+          k += 3;
+        }
+        break;
+      }
     }
   }
 
-  void navigate(const std::string &url) {
-    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(m_webview), url.c_str());
+  // Objects list the nodes of their keys (each value follows its key)
+  void build_children() {
+    for (auto &container : m_nodes) {
+      if (container.type != json_type::array &&
+          container.type != json_type::object) {
+        continue;
+      }
+      container.first = static_cast<uint32_t>(m_children.size());
+      auto child = static_cast<uint32_t>(&container - m_nodes.data()) + 1;
+      for (uint32_t i = 0; i < container.count; ++i) {
+        m_children.push_back(child);
+        child = container.type == json_type::object ? m_nodes[child + 1].next
+                                                    : m_nodes[child].next;
+      }
+    }
   }
 
-  void set_html(const std::string &html) {
-    webkit_web_view_load_html(WEBKIT_WEB_VIEW(m_webview), html.c_str(), NULL);
-  }
+  std::string_view m_json;
+  std::vector<uint32_t> m_index;
+  std::vector<node> m_nodes;
+  std::vector<uint32_t> m_children;
+};
 
-  void init(const std::string &js) {
-    WebKitUserContentManager *manager =
-        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
-    webkit_user_content_manager_add_script(
-        manager, webkit_user_script_new(
-                     js.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
-                     WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL));
-  }
+inline json_type json_value::type() const {
+  return m_doc->m_nodes[m_node].type;
+}
 
-  void eval(const std::string &js) {
-    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(m_webview), js.c_str(), NULL,
-                                   NULL, NULL);
+inline std::string_view json_value::raw() const {
+  if (!valid()) {
+    return {};
   }
+  const auto &n = m_doc->m_nodes[m_node];
+  return m_doc->m_json.substr(n.offset, n.size);
+}
 
-private:
-  virtual void on_message(const std::string &msg) = 0;
+inline size_t json_value::size() const {
+  return valid() ? m_doc->m_nodes[m_node].count : 0;
+}
 
-  static char *get_string_from_js_result(WebKitJavascriptResult *r) {
-    char *s;
-#if WEBKIT_MAJOR_VERSION >= 2 && WEBKIT_MINOR_VERSION >= 22
-    JSCValue *value = webkit_javascript_result_get_js_value(r);
-    s = jsc_value_to_string(value);
-#else
-    JSGlobalContextRef ctx = webkit_javascript_result_get_global_context(r);
-    JSValueRef value = webkit_javascript_result_get_value(r);
-    JSStringRef js = JSValueToStringCopy(ctx, value, NULL);
-    size_t n = JSStringGetMaximumUTF8CStringSize(js);
-    s = g_new(char, n);
-    JSStringGetUTF8CString(js, s, n);
-    JSStringRelease(js);
-#endif
-    return s;
+inline json_value json_value::operator[](size_t i) const {
+  if (!valid()) {
+    return {};
   }
+  const auto &n = m_doc->m_nodes[m_node];
+  if ((n.type != json_type::array && n.type != json_type::object) ||
+      i >= n.count) {
+    return {};
+  }
+  const auto child = m_doc->m_children[n.first + i];
+  return {m_doc, n.type == json_type::object ? child + 1 : child};
+}
 
-  GtkWidget *m_window;
-  GtkWidget *m_webview;
-};
-
-} // namespace detail
+inline json_value json_value::operator[](std::string_view key) const {
+  if (!valid() || type() != json_type::object) {
+    return {};
+  }
+  const auto &n = m_doc->m_nodes[m_node];
+  for (uint32_t i = 0; i < n.count; ++i) {
+    const auto child = m_doc->m_children[n.first + i];
+    const auto &k = m_doc->m_nodes[child];
+    if (k.size - 2 == key.size() &&
+        m_doc->m_json.substr(k.offset + 1, k.size - 2) == key) {
+      return {m_doc, child + 1};
+    }
+  }
+  return {};
+}
 
-using browser_engine = detail::gtk_webkit_engine;
+inline std::string_view json_value::key(size_t i) const {
+  if (!valid() || type() != json_type::object || i >= size()) {
+    return {};
+  }
+  const auto &k =
+      m_doc->m_nodes[m_doc->m_children[m_doc->m_nodes[m_node].first + i]];
+  return m_doc->m_json.substr(k.offset + 1, k.size - 2);
+}
 
-} // namespace webview
+inline bool json_value::get(bool &out) const {
+  if (!valid() || type() != json_type::boolean) {
+    return false;
+  }
+  out = raw() == "true";
+  return true;
+}
 
-#elif 0 // defined(WEBVIEW_COCOA)
+inline bool json_value::get(std::string_view &out) const {
+  return valid() && type() == json_type::string && json_unquote(raw(), out);
+}
 
-//
-// ====================================================================
-//
-// This implementation uses Cocoa WKWebView backend on macOS. It is
-// written using ObjC runtime and uses WKWebView class as a browser runtime.
-// You should pass "-framework Webkit" flag to the compiler.
-//
-// ====================================================================
-//
+inline bool json_value::get(std::string &out) const {
+  if (!valid() || type() != json_type::string) {
+    return false;
+  }
+  std::string_view content;
+  if (json_unquote(raw(), content)) {
+    out.assign(content);
+    return true;
+  }
+  out.clear();
+  return json_unescape(raw(), out);
+}
 
-#include <CoreGraphics/CoreGraphics.h>
-#include <objc/NSObjCRuntime.h>
-#include <objc/objc-runtime.h>
+// Whether text is a single valid JSON value
+inline bool json_valid(std::string_view text) {
+  json_document doc;
+  return doc.parse(text);
+}
 
-namespace webview {
-namespace detail {
-namespace objc {
+// ilpropheta: helpers of the binary bindings
+constexpr auto binary_chunk_method = "__webview_binary_chunk";
+constexpr size_t binary_chunk_size = 1024 * 1024;
+// Bytes a call can upload in chunks, it fails beyond
+constexpr size_t max_binary_upload = 256 * 1024 * 1024;
+
+inline void base64_encode(std::span<const std::byte> data, std::string &out) {
+  constexpr char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  out.reserve(out.size() + (data.size() + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 3 <= data.size(); i += 3) {
+    const auto v = (std::to_integer<uint32_t>(data[i]) << 16) |
+                   (std::to_integer<uint32_t>(data[i + 1]) << 8) |
+                   std::to_integer<uint32_t>(data[i + 2]);
+    const char quad[] = {alphabet[v >> 18], alphabet[(v >> 12) & 0x3f],
+                         alphabet[(v >> 6) & 0x3f], alphabet[v & 0x3f]};
+    out.append(quad, sizeof(quad));
+  }
+  if (const auto rest = data.size() - i) {
+    auto v = std::to_integer<uint32_t>(data[i]) << 16;
+    if (rest == 2) {
+      v |= std::to_integer<uint32_t>(data[i + 1]) << 8;
+    }
+    const char quad[] = {alphabet[v >> 18], alphabet[(v >> 12) & 0x3f],
+                         rest == 2 ? alphabet[(v >> 6) & 0x3f] : '=', '='};
+    out.append(quad, sizeof(quad));
+  }
+}
 
-// A convenient template function for unconditionally casting the specified
-// C-like function into a function that can be called with the given return
-// type and arguments. Caller takes full responsibility for ensuring that
-// the function call is valid. It is assumed that the function will not
-// throw exceptions.
-template <typename Result, typename Callable, typename... Args>
-Result invoke(Callable callable, Args... args) noexcept {
-  return reinterpret_cast<Result (*)(Args...)>(callable)(args...);
+// Appends the decoded bytes to out, returns false if s is not valid base64
+inline bool base64_decode(std::string_view s, std::vector<std::byte> &out) {
+  auto value = [](char c) -> int {
+    if (c >= 'A' && c <= 'Z') {
+      return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+      return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+      return c - '0' + 52;
+    }
+    return c == '+' ? 62 : c == '/' ? 63 : -1;
+  };
+  if (s.size() % 4 != 0) {
+    return false;
+  }
+  out.reserve(out.size() + s.size() / 4 * 3);
+  for (size_t i = 0; i < s.size(); i += 4) {
+    const auto padding = i + 4 == s.size()
+                             ? (s[i + 3] == '=') + (s[i + 2] == '=' ? 1 : 0)
+                             : 0;
+    uint32_t v = 0;
+    for (size_t j = 0; j < 4 - static_cast<size_t>(padding); ++j) {
+      const auto d = value(s[i + j]);
+      if (d < 0) {
+        return false;
+      }
+      v |= static_cast<uint32_t>(d) << (18 - 6 * j);
+    }
+    out.push_back(static_cast<std::byte>(v >> 16));
+    if (padding < 2) {
+      out.push_back(static_cast<std::byte>((v >> 8) & 0xff));
+    }
+    if (padding < 1) {
+      out.push_back(static_cast<std::byte>(v & 0xff));
+    }
+  }
+  return true;
 }
 
-// Calls objc_msgSend.
-template <typename Result, typename... Args>
-Result msg_send(Args... args) noexcept {
-  return invoke<Result>(objc_msgSend, args...);
+// Decodes the %XX sequences of an URL component
+inline std::string percent_decode(std::string_view s) {
+  std::string out;
+  out.reserve(s.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned value = 0;
+    if (s[i] == '%' && i + 2 < s.size() &&
+        std::from_chars(s.data() + i + 1, s.data() + i + 3, value, 16).ptr ==
+            s.data() + i + 3) {
+      out.push_back(static_cast<char>(value));
+      i += 2;
+    } else {
+      out.push_back(s[i]);
+    }
+  }
+  return out;
 }
 
-} // namespace objc
+// ilpropheta: engine-independent dispatch queue. Producers (any thread) push
+// lock-free into an intrusive MPSC queue (D. Vyukov's), and only the push
+// that finds no wakeup pending asks the engine to post one. The window
+// thread drains in bounded batches: when the batch is over (by count or by
+// time), it posts another wakeup so that input messages queued in the
+// meantime are not starved. The high lane is drained before the normal one.
+enum class dispatch_lane { normal, high };
 
-enum NSBackingStoreType : NSUInteger { NSBackingStoreBuffered = 2 };
+class dispatch_queue {
+public:
+  static constexpr size_t default_max_batch = 256;
+  static constexpr auto default_time_budget = std::chrono::milliseconds{8};
+
+  dispatch_queue() = default;
+  dispatch_queue(const dispatch_queue &) = delete;
+  dispatch_queue &operator=(const dispatch_queue &) = delete;
+  ~dispatch_queue() {
+    for (auto &l : m_lanes) {
+      while (auto n = l.pop()) {
+        delete n;
+      }
+    }
+  }
 
-enum NSWindowStyleMask : NSUInteger {
-  NSWindowStyleMaskTitled = 1,
-  NSWindowStyleMaskClosable = 2,
-  NSWindowStyleMaskMiniaturizable = 4,
-  NSWindowStyleMaskResizable = 8
-};
+  // Any thread. Returns true if the caller must post a wakeup
+  bool push(dispatch_fn_t fn, dispatch_lane lane = dispatch_lane::normal) {
+    m_lanes[lane == dispatch_lane::high ? 0 : 1].push(
+        new node{{nullptr}, std::move(fn)});
+    return !m_wakeup_pending.exchange(true);
+  }
 
-enum NSApplicationActivationPolicy : NSInteger {
-  NSApplicationActivationPolicyRegular = 0
-};
+  // Window thread, on wakeup. Runs up to max_batch functions or until
+  // time_budget expires; returns true if the caller must post another
+  // wakeup because some functions are left. If a function throws, the
+  // exception reaches the caller and the functions left run on the wakeup
+  // posted by the next push
+  bool drain(size_t max_batch = default_max_batch,
+             std::chrono::steady_clock::duration time_budget =
+                 default_time_budget) {
+    m_wakeup_pending.store(false);
+    struct rearm {
+      std::atomic<bool> &wakeup_pending;
+      const int exceptions = std::uncaught_exceptions();
+      ~rearm() {
+        if (std::uncaught_exceptions() > exceptions) {
+          wakeup_pending.store(false);
+        }
+      }
+    } guard{m_wakeup_pending};
+    const auto deadline = std::chrono::steady_clock::now() + time_budget;
+    for (size_t done = 0; done < max_batch; ++done) {
+      // owned before it runs, so that it is freed even if fn throws
+      std::unique_ptr<node> n{m_lanes[0].pop()};
+      if (!n) {
+        n.reset(m_lanes[1].pop());
+      }
+      if (!n) {
+        return false;
+      }
+      n->fn();
+      if (done % 16 == 15 && std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+    }
+    return !m_wakeup_pending.exchange(true);
+  }
 
-enum WKUserScriptInjectionTime : NSInteger {
-  WKUserScriptInjectionTimeAtDocumentStart = 0
-};
+  // The wakeup asked for by push or drain could not be posted: the next push
+  // asks again (the engine should also drain now and then, in case nobody
+  // pushes anymore)
+  void wakeup_lost() { m_wakeup_pending.store(false); }
 
-enum NSModalResponse : NSInteger { NSModalResponseOK = 1 };
+private:
+  struct node {
+    std::atomic<node *> next;
+    dispatch_fn_t fn;
+  };
 
-// Convenient conversion of string literals.
-id operator"" _cls(const char *s, std::size_t) { return (id)objc_getClass(s); }
-SEL operator"" _sel(const char *s, std::size_t) { return sel_registerName(s); }
-id operator"" _str(const char *s, std::size_t) {
-  return objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel, s);
-}
+  class lane {
+  public:
+    void push(node *n) {
+      n->next.store(nullptr, std::memory_order_relaxed);
+      const auto prev = m_head.exchange(n, std::memory_order_acq_rel);
+      prev->next.store(n, std::memory_order_release);
+    }
 
-class cocoa_wkwebview_engine {
+    // Single consumer. Might return nullptr while a push is halfway, that
+    // push will be visible to the next drain
+    node *pop() {
+      auto tail = m_tail;
+      auto next = tail->next.load(std::memory_order_acquire);
+      if (tail == &m_stub) {
+        if (!next) {
+          return nullptr;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+      if (next) {
+        m_tail = next;
+        return tail;
+      }
+      if (tail != m_head.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      push(&m_stub);
+      next = tail->next.load(std::memory_order_acquire);
+      if (next) {
+        m_tail = next;
+        return tail;
+      }
+      return nullptr;
+    }
+
+  private:
+    node m_stub{{nullptr}, {}};
+    std::atomic<node *> m_head{&m_stub};
+    node *m_tail = &m_stub;
+  };
+
+  lane m_lanes[2]; // high, normal
+  std::atomic<bool> m_wakeup_pending{false};
+};
+
+// ilpropheta: owning name -> context map for bindings, a flat open-addressing
+// table looked up by std::string_view (no key is allocated). Lookups take a
+// shared lock, so they don't exclude each other and can run off the window
+// thread, while writers (bind and unbind, rare) take it exclusively and update
+// the table in place. Reads are not lock-free: the lock-free table this
+// replaced wrote a shared reader counter on every lookup, which was slower
+// than a std::map for a few bindings, and could free the tables it replaced
+// only when no lookup was in progress (headless/registry_bench.cpp measures
+// lookups). Contexts are reference counted, so one stays alive while whoever
+// found it is using it, even if it gets unbound meanwhile
+template <typename T> class binding_registry {
 public:
-  cocoa_wkwebview_engine(bool debug, void *window)
-      : m_debug{debug}, m_parent_window{window} {
-    auto app = get_shared_application();
-    auto delegate = create_app_delegate();
-    objc_setAssociatedObject(delegate, "webview", (id)this,
-                             OBJC_ASSOCIATION_ASSIGN);
-    objc::msg_send<void>(app, "setDelegate:"_sel, delegate);
+  binding_registry() = default;
+  binding_registry(const binding_registry &) = delete;
+  binding_registry &operator=(const binding_registry &) = delete;
+
+  std::shared_ptr<T> find(std::string_view name) const {
+    std::shared_lock lock{m_mutex};
+    const auto s = probe(name, hash(name));
+    return s ? s->value : nullptr;
+  }
 
-    // Start the main run loop so that the app delegate gets the
-    // NSApplicationDidFinishLaunchingNotification notification after the run
-    // loop has started in order to perform further initialization.
-    // We need to return from this constructor so this run loop is only
-    // temporary.
-    objc::msg_send<void>(app, "run"_sel);
+  bool contains(std::string_view name) const {
+    std::shared_lock lock{m_mutex};
+    return probe(name, hash(name)) != nullptr;
   }
-  virtual ~cocoa_wkwebview_engine() = default;
-  void *window() { return (void *)m_window; }
-  void terminate() {
-    auto app = get_shared_application();
-    objc::msg_send<void>(app, "terminate:"_sel, nullptr);
+
+  // Returns false (and drops value) if name is already bound
+  bool insert(std::string_view name, std::shared_ptr<T> value) {
+    std::unique_lock lock{m_mutex};
+    const auto h = hash(name);
+    if (probe(name, h)) {
+      return false;
+    }
+    if ((m_size + 1) * 2 > m_slots.size()) {
+      rehash(std::bit_ceil(std::max<size_t>((m_size + 1) * 2, 8)));
+    }
+    place(slot{h, std::string(name), std::move(value)});
+    return true;
   }
-  void run() {
-    auto app = get_shared_application();
-    objc::msg_send<void>(app, "run"_sel);
+
+  // Returns the context that was bound to name, if any
+  std::shared_ptr<T> erase(std::string_view name) {
+    std::shared_ptr<T> erased;
+    std::unique_lock lock{m_mutex};
+    const auto s = probe(name, hash(name));
+    if (!s) {
+      return nullptr;
+    }
+    // backward shift: the slots following s in its probe sequence move up,
+    // so that no lookup stops at the hole
+    const auto mask = m_slots.size() - 1;
+    auto hole = static_cast<size_t>(s - m_slots.data());
+    erased = std::move(m_slots[hole].value);
+    for (auto i = (hole + 1) & mask; m_slots[i].value; i = (i + 1) & mask) {
+      const auto home = m_slots[i].hash & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        m_slots[hole] = std::move(m_slots[i]);
+        hole = i;
+      }
+    }
+    m_slots[hole] = slot{};
+    --m_size;
+    return erased;
   }
-  void dispatch(std::function<void()> f) {
-    dispatch_async_f(dispatch_get_main_queue(), new dispatch_fn_t(f),
-                     (dispatch_function_t)([](void *arg) {
-                       auto f = static_cast<dispatch_fn_t *>(arg);
-                       (*f)();
-                       delete f;
-                     }));
+
+  // Calls f(name, value) for each binding, with writers locked out
+  template <typename F> void for_each(F f) const {
+    std::shared_lock lock{m_mutex};
+    for (const auto &s : m_slots) {
+      if (s.value) {
+        f(std::string_view{s.name}, *s.value);
+      }
+    }
   }
-  void set_title(const std::string &title) {
-    objc::msg_send<void>(m_window, "setTitle:"_sel,
-                         objc::msg_send<id>("NSString"_cls,
-                                            "stringWithUTF8String:"_sel,
-                                            title.c_str()));
+
+  // The contexts are released after the lock, in case one's destructor uses
+  // the registry
+  void clear() {
+    std::vector<slot> cleared;
+    std::unique_lock lock{m_mutex};
+    cleared.swap(m_slots);
+    m_size = 0;
   }
-  void set_size(int width, int height, int hints) {
-    auto style = static_cast<NSWindowStyleMask>(
-        NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
-        NSWindowStyleMaskMiniaturizable);
-    if (hints != WEBVIEW_HINT_FIXED) {
-      style =
-          static_cast<NSWindowStyleMask>(style | NSWindowStyleMaskResizable);
-    }
-    objc::msg_send<void>(m_window, "setStyleMask:"_sel, style);
 
-    if (hints == WEBVIEW_HINT_MIN) {
-      objc::msg_send<void>(m_window, "setContentMinSize:"_sel,
-                           CGSizeMake(width, height));
-    } else if (hints == WEBVIEW_HINT_MAX) {
-      objc::msg_send<void>(m_window, "setContentMaxSize:"_sel,
-                           CGSizeMake(width, height));
-    } else {
-      objc::msg_send<void>(m_window, "setFrame:display:animate:"_sel,
-                           CGRectMake(0, 0, width, height), YES, NO);
+private:
+  struct slot {
+    size_t hash = 0;
+    std::string name;
+    std::shared_ptr<T> value; // empty slot if null
+  };
+
+  static size_t hash(std::string_view name) {
+    return std::hash<std::string_view>{}(name);
+  }
+
+  const slot *probe(std::string_view name, size_t h) const {
+    if (m_slots.empty()) {
+      return nullptr;
+    }
+    const auto mask = m_slots.size() - 1;
+    for (auto i = h & mask;; i = (i + 1) & mask) {
+      const auto &s = m_slots[i];
+      if (!s.value) {
+        return nullptr;
+      }
+      if (s.hash == h && s.name == name) {
+        return &s;
+      }
     }
-    objc::msg_send<void>(m_window, "center"_sel);
   }
-  void navigate(const std::string &url) {
-    auto nsurl = objc::msg_send<id>(
-        "NSURL"_cls, "URLWithString:"_sel,
-        objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
-                           url.c_str()));
 
-    objc::msg_send<void>(
-        m_webview, "loadRequest:"_sel,
-        objc::msg_send<id>("NSURLRequest"_cls, "requestWithURL:"_sel, nsurl));
+  void place(slot s) {
+    const auto mask = m_slots.size() - 1;
+    auto i = s.hash & mask;
+    while (m_slots[i].value) {
+      i = (i + 1) & mask;
+    }
+    m_slots[i] = std::move(s);
+    ++m_size;
   }
-  void set_html(const std::string &html) {
-    objc::msg_send<void>(m_webview, "loadHTMLString:baseURL:"_sel,
-                         objc::msg_send<id>("NSString"_cls,
-                                            "stringWithUTF8String:"_sel,
-                                            html.c_str()),
-                         nullptr);
+
+  void rehash(size_t slots) {
+    auto old = std::exchange(m_slots, std::vector<slot>(slots));
+    m_size = 0;
+    for (auto &s : old) {
+      if (s.value) {
+        place(std::move(s));
+      }
+    }
   }
-  void init(const std::string &js) {
-    // Equivalent Obj-C:
-    // [m_manager addUserScript:[[WKUserScript alloc] initWithSource:[NSString stringWithUTF8String:js.c_str()] injectionTime:WKUserScriptInjectionTimeAtDocumentStart forMainFrameOnly:YES]]
-    objc::msg_send<void>(
-        m_manager, "addUserScript:"_sel,
-        objc::msg_send<id>(objc::msg_send<id>("WKUserScript"_cls, "alloc"_sel),
-                           "initWithSource:injectionTime:forMainFrameOnly:"_sel,
-                           objc::msg_send<id>("NSString"_cls,
-                                              "stringWithUTF8String:"_sel,
-                                              js.c_str()),
-                           WKUserScriptInjectionTimeAtDocumentStart, YES));
+
+  mutable std::shared_mutex m_mutex;
+  std::vector<slot> m_slots; // size is a power of two, at most half full
+  size_t m_size = 0;
+};
+
+// ilpropheta: work-stealing thread pool for bindings that must not run on the
+// window thread. Every worker has its own queue: tasks submitted by a worker
+// go to its queue, the others are spread round-robin, and an idle worker
+// steals from the back of the other queues before parking. Every worker parks
+// on its own condition variable, and a submission wakes one only if some are
+// parked: submitting a task to a busy pool takes no lock but the one of the
+// target queue. Tasks still queued when the pool is destroyed are dropped
+class thread_pool {
+public:
+  explicit thread_pool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+      m_workers.push_back(std::make_unique<worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      m_threads.emplace_back([this, i] { work(i); });
+    }
   }
-  void eval(const std::string &js) {
-    objc::msg_send<void>(m_webview, "evaluateJavaScript:completionHandler:"_sel,
-                         objc::msg_send<id>("NSString"_cls,
-                                            "stringWithUTF8String:"_sel,
-                                            js.c_str()),
-                         nullptr);
+
+  ~thread_pool() {
+    m_stop.store(true);
+    for (auto &w : m_workers) {
+      w->wake();
+    }
+    for (auto &t : m_threads) {
+      t.join();
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  size_t size() const { return m_threads.size(); }
+
+  void submit(dispatch_fn_t task) {
+    const auto target = current_pool() == this
+                            ? current_worker()
+                            : m_next.fetch_add(1, std::memory_order_relaxed) %
+                                  m_workers.size();
+    {
+      std::lock_guard lock{m_workers[target]->mutex};
+      m_workers[target]->tasks.push_back(std::move(task));
+    }
+    wake_one(target);
   }
 
 private:
-  virtual void on_message(const std::string &msg) = 0;
-  static id create_app_delegate() {
-    auto cls =
-        objc_allocateClassPair((Class) "NSResponder"_cls, "AppDelegate", 0);
-    class_addProtocol(cls, objc_getProtocol("NSTouchBarProvider"));
-    class_addMethod(cls, "applicationShouldTerminateAfterLastWindowClosed:"_sel,
-                    (IMP)(+[](id, SEL, id) -> BOOL { return 1; }), "c@:@");
-    class_addMethod(
-        cls, "userContentController:didReceiveScriptMessage:"_sel,
-        (IMP)(+[](id self, SEL, id, id msg) {
-          auto w = get_associated_webview(self);
-          w->on_message(((const char *(*)(id, SEL))objc_msgSend)(
-              objc::msg_send<id>(msg, "body"_sel), "UTF8String"_sel));
-        }),
-        "v@:@@");
-    class_addMethod(cls, "applicationDidFinishLaunching:"_sel,
-                    (IMP)(+[](id self, SEL, id notification) {
-                      auto app = objc::msg_send<id>(notification, "object"_sel);
-                      auto w = get_associated_webview(self);
-                      w->on_application_did_finish_launching(self, app);
-                    }),
-                    "v@:@");
-    objc_registerClassPair(cls);
-    return objc::msg_send<id>((id)cls, "new"_sel);
+  struct worker {
+    std::mutex mutex;
+    std::deque<dispatch_fn_t> tasks;
+    std::atomic<bool> parked{false};
+    std::mutex park_mutex; // for woken only
+    std::condition_variable park_wakeup;
+    bool woken = false;
+
+    void wake() {
+      {
+        std::lock_guard lock{park_mutex};
+        woken = true;
+      }
+      park_wakeup.notify_one();
+    }
+  };
+
+  static const thread_pool *&current_pool() {
+    thread_local const thread_pool *pool = nullptr;
+    return pool;
+  }
+  static size_t &current_worker() {
+    thread_local size_t index = 0;
+    return index;
   }
-  static id create_webkit_ui_delegate() {
-    auto cls =
-        objc_allocateClassPair((Class) "NSObject"_cls, "WebkitUIDelegate", 0);
-    class_addProtocol(cls, objc_getProtocol("WKUIDelegate"));
-    class_addMethod(
-        cls,
-        "webView:runOpenPanelWithParameters:initiatedByFrame:completionHandler:"_sel,
-        (IMP)(+[](id, SEL, id, id parameters, id, id completion_handler) {
-          auto allows_multiple_selection =
-              objc::msg_send<BOOL>(parameters, "allowsMultipleSelection"_sel);
-          auto allows_directories =
-              objc::msg_send<BOOL>(parameters, "allowsDirectories"_sel);
 
-          // Show a panel for selecting files.
-          auto panel = objc::msg_send<id>("NSOpenPanel"_cls, "openPanel"_sel);
-          objc::msg_send<void>(panel, "setCanChooseFiles:"_sel, YES);
-          objc::msg_send<void>(panel, "setCanChooseDirectories:"_sel,
-                               allows_directories);
-          objc::msg_send<void>(panel, "setAllowsMultipleSelection:"_sel,
-                               allows_multiple_selection);
-          auto modal_response =
-              objc::msg_send<NSModalResponse>(panel, "runModal"_sel);
+  void work(size_t self) {
+    current_pool() = this;
+    current_worker() = self;
+    while (!m_stop.load()) {
+      dispatch_fn_t task;
+      if (take(self, task)) {
+        task();
+      } else {
+        park(self);
+      }
+    }
+  }
 
-          // Get the URLs for the selected files. If the modal was canceled
-          // then we pass null to the completion handler to signify
-          // cancellation.
-          id urls = modal_response == NSModalResponseOK
-                        ? objc::msg_send<id>(panel, "URLs"_sel)
-                        : nullptr;
+  // A submission that doesn't see the worker parked pushed its task before
+  // the queues are checked again (the queue locks order the two), so no
+  // wakeup is lost
+  void park(size_t self) {
+    auto &w = *m_workers[self];
+    w.parked.store(true);
+    m_parked.fetch_add(1);
+    if (has_tasks() || m_stop.load()) {
+      // unless a submission woke it meanwhile, and counted it already
+      if (w.parked.exchange(false)) {
+        m_parked.fetch_sub(1);
+        return;
+      }
+    }
+    std::unique_lock lock{w.park_mutex};
+    w.park_wakeup.wait(lock, [&w] { return w.woken; });
+    w.woken = false;
+  }
 
-          // Invoke the completion handler block.
-          auto sig = objc::msg_send<id>("NSMethodSignature"_cls,
-                                        "signatureWithObjCTypes:"_sel, "v@?@");
-          auto invocation = objc::msg_send<id>(
-              "NSInvocation"_cls, "invocationWithMethodSignature:"_sel, sig);
-          objc::msg_send<void>(invocation, "setTarget:"_sel,
-                               completion_handler);
-          objc::msg_send<void>(invocation, "setArgument:atIndex:"_sel, &urls,
-                               1);
-          objc::msg_send<void>(invocation, "invoke"_sel);
-        }),
-        "v@:@@@@");
-    objc_registerClassPair(cls);
-    return objc::msg_send<id>((id)cls, "new"_sel);
+  // Wakes a parked worker, the one of the queue the task went to if it's
+  // parked: any other steals it
+  void wake_one(size_t preferred) {
+    if (m_parked.load() == 0) {
+      return;
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+      auto &w = *m_workers[(preferred + i) % m_workers.size()];
+      if (w.parked.load() && w.parked.exchange(false)) {
+        m_parked.fetch_sub(1);
+        w.wake();
+        return;
+      }
+    }
   }
-  static id get_shared_application() {
-    return objc::msg_send<id>("NSApplication"_cls, "sharedApplication"_sel);
+
+  bool has_tasks() {
+    for (auto &w : m_workers) {
+      std::lock_guard lock{w->mutex};
+      if (!w->tasks.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool take(size_t self, dispatch_fn_t &task) {
+    {
+      auto &own = *m_workers[self];
+      std::lock_guard lock{own.mutex};
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.front());
+        own.tasks.pop_front();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+      auto &victim = *m_workers[(self + i) % m_workers.size()];
+      std::lock_guard lock{victim.mutex};
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<worker>> m_workers;
+  std::atomic<size_t> m_next{0};
+  std::atomic<size_t> m_parked{0};
+  std::atomic<bool> m_stop{false};
+  std::vector<std::thread> m_threads;
+};
+
+// ilpropheta: runs the tasks of a binding on a pool, at most limit at once
+// (0 means no limit); the others wait in order
+class concurrency_limiter {
+public:
+  concurrency_limiter(thread_pool &pool, size_t limit)
+      : m_pool(pool), m_limit(limit) {}
+
+  void submit(dispatch_fn_t task) {
+    if (m_limit == 0) {
+      m_pool.submit(std::move(task));
+      return;
+    }
+    {
+      std::lock_guard lock{m_state->mutex};
+      if (m_state->running == m_limit) {
+        m_state->waiting.push_back(std::move(task));
+        return;
+      }
+      ++m_state->running;
+    }
+    run(m_pool, m_state, std::move(task));
+  }
+
+private:
+  struct state {
+    std::mutex mutex;
+    size_t running = 0;
+    std::deque<dispatch_fn_t> waiting;
+  };
+
+  // When a task is over, the next waiting one takes its place
+  static void run(thread_pool &pool, std::shared_ptr<state> s,
+                  dispatch_fn_t task) {
+    pool.submit([&pool, s, task = std::move(task)]() {
+      task();
+      std::lock_guard lock{s->mutex};
+      if (s->waiting.empty()) {
+        --s->running;
+        return;
+      }
+      auto next = std::move(s->waiting.front());
+      s->waiting.pop_front();
+      run(pool, s, std::move(next));
+    });
+  }
+
+  thread_pool &m_pool;
+  size_t m_limit;
+  std::shared_ptr<state> m_state = std::make_shared<state>();
+};
+
+// ilpropheta: a single thread that runs callbacks when their time comes.
+// Callbacks must be short (they usually just dispatch); the ones still
+// pending when the queue is destroyed are dropped
+class timer_queue {
+public:
+  using clock = std::chrono::steady_clock;
+
+  timer_queue() : m_thread([this] { run(); }) {}
+
+  ~timer_queue() {
+    {
+      std::lock_guard lock{m_mutex};
+      m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+
+  timer_queue(const timer_queue &) = delete;
+  timer_queue &operator=(const timer_queue &) = delete;
+
+  void add(clock::time_point when, dispatch_fn_t fn) {
+    bool earliest;
+    {
+      std::lock_guard lock{m_mutex};
+      const auto it = m_timers.emplace(when, std::move(fn));
+      earliest = it == m_timers.begin();
+    }
+    if (earliest) {
+      m_wake.notify_one();
+    }
+  }
+
+private:
+  void run() {
+    std::unique_lock lock{m_mutex};
+    while (!m_stop) {
+      if (m_timers.empty()) {
+        m_wake.wait(lock);
+      } else if (const auto first = m_timers.begin();
+                 first->first <= clock::now()) {
+        auto fn = std::move(first->second);
+        m_timers.erase(first);
+        lock.unlock();
+        fn();
+        lock.lock();
+      } else {
+        m_wake.wait_until(lock, first->first);
+      }
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::multimap<clock::time_point, dispatch_fn_t> m_timers;
+  bool m_stop = false;
+  std::thread m_thread;
+};
+
+// ilpropheta: latency histogram with HDR-like log-linear buckets: values
+// below 16 have a bucket each, then every power of two is split in 8 buckets
+// (12.5% precision) up to 2^36. Safe to record from any thread
+class latency_histogram {
+public:
+  static constexpr size_t sub_bits = 3;
+  static constexpr size_t max_bits = 36;
+  static constexpr size_t buckets = (max_bits - sub_bits + 2) << sub_bits;
+
+  static size_t bucket(uint64_t value) {
+    if (value < (uint64_t{2} << sub_bits)) {
+      return static_cast<size_t>(value);
+    }
+    const auto msb = static_cast<size_t>(std::bit_width(value)) - 1;
+    if (msb > max_bits) {
+      return buckets - 1;
+    }
+    const auto shift = msb - sub_bits;
+    const auto sub = (value >> shift) & ((uint64_t{1} << sub_bits) - 1);
+    return ((shift + 1) << sub_bits) + static_cast<size_t>(sub);
+  }
+
+  // Highest value of a bucket
+  static uint64_t upper_bound(size_t bucket) {
+    if (bucket < (size_t{2} << sub_bits)) {
+      return bucket;
+    }
+    const auto shift = (bucket >> sub_bits) - 1;
+    const auto sub = bucket & ((size_t{1} << sub_bits) - 1);
+    return (((uint64_t{1} << sub_bits) + sub + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    m_counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void add_to(std::array<uint64_t, buckets> &counts) const {
+    for (size_t i = 0; i < buckets; ++i) {
+      counts[i] += m_counts[i].load(std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, buckets> m_counts{};
+};
+
+// ilpropheta: statistics of a binding, sharded so that threads recording at
+// the same time don't share cache lines. Latencies are in microseconds
+class binding_stats {
+public:
+  static constexpr size_t shards = 4;
+
+  struct snapshot {
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    std::array<uint64_t, latency_histogram::buckets> queue{};
+    std::array<uint64_t, latency_histogram::buckets> exec{};
+  };
+
+  void called(size_t bytes) {
+    auto &s = shard();
+    s.calls.fetch_add(1, std::memory_order_relaxed);
+    s.bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void completed(bool error, size_t bytes, uint64_t queue_us,
+                 uint64_t exec_us) {
+    auto &s = shard();
+    if (error) {
+      s.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    s.bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+    s.queue.record(queue_us);
+    s.exec.record(exec_us);
+  }
+
+  snapshot take() const {
+    snapshot out;
+    for (const auto &s : m_shards) {
+      out.calls += s.calls.load(std::memory_order_relaxed);
+      out.errors += s.errors.load(std::memory_order_relaxed);
+      out.bytes_in += s.bytes_in.load(std::memory_order_relaxed);
+      out.bytes_out += s.bytes_out.load(std::memory_order_relaxed);
+      s.queue.add_to(out.queue);
+      s.exec.add_to(out.exec);
+    }
+    return out;
+  }
+
+private:
+  struct alignas(64) counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    latency_histogram queue;
+    latency_histogram exec;
+  };
+
+  counters &shard() {
+    static std::atomic<size_t> next{0};
+    thread_local const size_t index = next.fetch_add(1) % shards;
+    return m_shards[index];
+  }
+
+  std::array<counters, shards> m_shards;
+};
+
+// Appends {"p50":..,"p90":..,"p99":..,"max":..} of a histogram
+inline void append_percentiles(
+    const std::array<uint64_t, latency_histogram::buckets> &counts,
+    std::string &out) {
+  uint64_t total = 0;
+  size_t last = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    total += counts[i];
+    if (counts[i]) {
+      last = i;
+    }
+  }
+  auto percentile = [&](uint64_t per_mille) {
+    const auto rank = (total * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      seen += counts[i];
+      if (seen >= rank && seen) {
+        return latency_histogram::upper_bound(i);
+      }
+    }
+    return uint64_t{0};
+  };
+  out += "{\"p50\":" + std::to_string(percentile(500)) +
+         ",\"p90\":" + std::to_string(percentile(900)) +
+         ",\"p99\":" + std::to_string(percentile(990)) + ",\"max\":" +
+         std::to_string(total ? latency_histogram::upper_bound(last) : 0) +
+         "}";
+}
+
+// ilpropheta: canonical text of a JSON value, the key of cached results:
+// no blanks and the members of objects sorted by name (strings and numbers
+// are kept as they are)
+inline void json_canonical(json_value v, std::string &out) {
+  switch (v.type()) {
+  case json_type::array:
+    out += '[';
+    for (size_t i = 0; i < v.size(); ++i) {
+      if (i) {
+        out += ',';
+      }
+      json_canonical(v[i], out);
+    }
+    out += ']';
+    break;
+  case json_type::object: {
+    std::vector<size_t> members(v.size());
+    for (size_t i = 0; i < members.size(); ++i) {
+      members[i] = i;
+    }
+    std::stable_sort(members.begin(), members.end(),
+                     [&v](size_t a, size_t b) { return v.key(a) < v.key(b); });
+    out += '{';
+    for (const auto i : members) {
+      if (out.back() != '{') {
+        out += ',';
+      }
+      out.append("\"").append(v.key(i)).append("\":");
+      json_canonical(v[i], out);
+    }
+    out += '}';
+    break;
+  }
+  default:
+    out += v.raw();
+  }
+}
+
+// Malformed JSON is its own key
+inline std::string json_canonical(std::string_view json) {
+  json_document doc;
+  if (!doc.parse(json)) {
+    return std::string(json);
+  }
+  std::string out;
+  out.reserve(json.size());
+  json_canonical(doc.root(), out);
+  return out;
+}
+
+// ilpropheta: results of a binding by canonical params, dropped when they
+// are older than the time to live (if any) and, least recently used first,
+// when keys and results take more than the byte budget. Every invalidation
+// starts a new generation, results of calls started before are not stored
+class result_cache {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct counters {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  result_cache(std::chrono::milliseconds ttl, size_t max_bytes)
+      : m_ttl(ttl), m_max_bytes(max_bytes) {}
+
+  bool find(const std::string &key, std::string &result) {
+    std::lock_guard lock{m_mutex};
+    const auto it = m_index.find(key);
+    if (it == m_index.end()) {
+      ++m_misses;
+      return false;
+    }
+    if (m_ttl.count() && it->second->expires <= clock::now()) {
+      erase(it->second);
+      ++m_misses;
+      return false;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    result = it->second->result;
+    ++m_hits;
+    return true;
+  }
+
+  uint64_t generation() const {
+    std::lock_guard lock{m_mutex};
+    return m_generation;
+  }
+
+  void store(std::string key, std::string result, uint64_t generation) {
+    const auto size = key.size() + result.size();
+    std::lock_guard lock{m_mutex};
+    if (generation != m_generation || size > m_max_bytes) {
+      return;
+    }
+    if (const auto it = m_index.find(key); it != m_index.end()) {
+      erase(it->second);
+    }
+    m_lru.push_front({std::move(key), std::move(result), clock::now() + m_ttl});
+    m_index.emplace(m_lru.front().key, m_lru.begin());
+    m_bytes += size;
+    while (m_bytes > m_max_bytes) {
+      erase(std::prev(m_lru.end()));
+    }
+  }
+
+  void invalidate(const std::string &key) {
+    std::lock_guard lock{m_mutex};
+    ++m_generation;
+    if (const auto it = m_index.find(key); it != m_index.end()) {
+      erase(it->second);
+    }
+  }
+
+  void invalidate() {
+    std::lock_guard lock{m_mutex};
+    ++m_generation;
+    m_index.clear();
+    m_lru.clear();
+    m_bytes = 0;
+  }
+
+  counters take() const {
+    std::lock_guard lock{m_mutex};
+    return {m_hits, m_misses, m_lru.size(), m_bytes};
+  }
+
+private:
+  struct entry {
+    std::string key;
+    std::string result;
+    clock::time_point expires;
+  };
+
+  void erase(std::list<entry>::iterator it) {
+    m_bytes -= it->key.size() + it->result.size();
+    m_index.erase(it->key);
+    m_lru.erase(it);
+  }
+
+  const std::chrono::milliseconds m_ttl;
+  const size_t m_max_bytes;
+  mutable std::mutex m_mutex;
+  std::list<entry> m_lru; // most recently used first
+  std::unordered_map<std::string_view, std::list<entry>::iterator> m_index;
+  size_t m_bytes = 0;
+  uint64_t m_generation = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+};
+
+// ilpropheta: constants of the streaming bindings
+constexpr auto stream_ack_method = "__webview_stream_ack";
+// Chunks the page can hold, not consumed yet, before a stream isn't writable
+constexpr size_t stream_window = 64;
+
+// ilpropheta: stream chunks, bus events and DOM events are flushed to the
+// page together, by a single message at most once per frame
+constexpr std::chrono::milliseconds frame_interval{16};
+
+constexpr auto subscribe_method = "__webview_subscribe";
+
+// ilpropheta: the page gave up on a call (see webview::cancellable_binding_t)
+constexpr auto cancel_method = "__webview_cancel";
+constexpr auto timeout_error = R"({"code":-32001,"message":"call timed out"})";
+
+template <typename T> struct task_result {
+  std::optional<T> value;
+  void return_value(T v) { value.emplace(std::move(v)); }
+  T take() { return std::move(*value); }
+};
+
+template <> struct task_result<void> {
+  void return_void() {}
+  void take() {}
+};
+
+// Coroutine that starts right away and owns itself: the frame is destroyed
+// when it's over
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+} // namespace detail
+
+// ilpropheta: result of a coroutine, the return type of coroutine bindings.
+// A task starts when it's awaited and, when it's over, resumes its awaiter
+// on the same thread; co_await gives back the value or rethrows the exception
+template <typename T = void> class task {
+public:
+  struct promise_type;
+  using handle = std::coroutine_handle<promise_type>;
+
+  struct promise_type : detail::task_result<T> {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    task get_return_object() { return task{handle::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      struct awaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle h) noexcept {
+          const auto next = h.promise().continuation;
+          return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return awaiter{};
+    }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  task(task &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (m_handle) {
+        m_handle.destroy();
+      }
+      m_handle = std::exchange(other.m_handle, {});
+    }
+    return *this;
+  }
+  ~task() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  auto operator co_await() noexcept {
+    struct awaiter {
+      handle h;
+      bool await_ready() noexcept { return h.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+        h.promise().continuation = awaiting;
+        return h;
+      }
+      T await_resume() {
+        if (h.promise().error) {
+          std::rethrow_exception(h.promise().error);
+        }
+        return h.promise().take();
+      }
+    };
+    return awaiter{m_handle};
+  }
+
+private:
+  explicit task(handle h) : m_handle(h) {}
+
+  handle m_handle;
+};
+
+// ilpropheta: thrown by a binding to reject the call with a JSON value (an
+// error object, usually) instead of the message of a plain exception
+class rejection : public std::exception {
+public:
+  explicit rejection(std::string json) : m_json(std::move(json)) {}
+  const std::string &json() const noexcept { return m_json; }
+  const char *what() const noexcept override { return m_json.c_str(); }
+
+private:
+  std::string m_json;
+};
+
+// ilpropheta: conversion of a C++ type from and to JSON, used by typed
+// bindings. A specialization has
+//   static bool decode(detail::json_value v, T &out); // false on mismatch
+//   static void encode(const T &in, std::string &out); // appends the JSON
+//   static constexpr std::string_view expected;        // for errors
+// Structs can derive their specialization from json_object, see below
+template <typename T, typename = void> struct json_traits;
+
+template <> struct json_traits<bool> {
+  static constexpr std::string_view expected = "boolean";
+  static bool decode(detail::json_value v, bool &out) { return v.get(out); }
+  static void encode(bool in, std::string &out) {
+    out += in ? "true" : "false";
+  }
+};
+
+template <typename T>
+struct json_traits<
+    T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>> {
+  static constexpr std::string_view expected = "number";
+  static bool decode(detail::json_value v, T &out) { return v.get(out); }
+  static void encode(T in, std::string &out) {
+    if constexpr (std::is_floating_point_v<T>) {
+      if (!std::isfinite(in)) { // NaN and infinities are not JSON
+        out += "null";
+        return;
+      }
+    }
+    char buffer[64];
+    const auto r = std::to_chars(buffer, buffer + sizeof(buffer), in);
+    out.append(buffer, r.ptr);
+  }
+};
+
+template <> struct json_traits<std::string> {
+  static constexpr std::string_view expected = "string";
+  static bool decode(detail::json_value v, std::string &out) {
+    return v.get(out);
+  }
+  static void encode(std::string_view in, std::string &out) {
+    detail::json_escape(in, out);
+  }
+};
+
+// Only strings without escape sequences decode to a view; parameters of
+// typed bindings don't have this limit
+template <> struct json_traits<std::string_view> {
+  static constexpr std::string_view expected = "string";
+  static bool decode(detail::json_value v, std::string_view &out) {
+    return v.get(out);
+  }
+  static void encode(std::string_view in, std::string &out) {
+    detail::json_escape(in, out);
+  }
+};
+
+// null, or a missing trailing argument, is an empty optional
+template <typename T> struct json_traits<std::optional<T>> {
+  static constexpr std::string_view expected = json_traits<T>::expected;
+  static bool decode(detail::json_value v, std::optional<T> &out) {
+    if (!v || v.is_null()) {
+      out.reset();
+      return true;
+    }
+    return json_traits<T>::decode(v, out.emplace());
+  }
+  static void encode(const std::optional<T> &in, std::string &out) {
+    if (in) {
+      json_traits<T>::encode(*in, out);
+    } else {
+      out += "null";
+    }
+  }
+};
+
+template <typename T> struct json_traits<std::vector<T>> {
+  static constexpr std::string_view expected = "array";
+  static bool decode(detail::json_value v, std::vector<T> &out) {
+    if (!v || v.type() != detail::json_type::array) {
+      return false;
+    }
+    out.clear();
+    out.reserve(v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+      T element{}; // not out[i], a proxy in std::vector<bool>
+      if (!json_traits<T>::decode(v[i], element)) {
+        return false;
+      }
+      out.push_back(std::move(element));
+    }
+    return true;
+  }
+  static void encode(const std::vector<T> &in, std::string &out) {
+    out += '[';
+    for (const auto &e : in) {
+      json_traits<T>::encode(e, out);
+      out += ',';
+    }
+    if (out.back() == ',') {
+      out.back() = ']';
+    } else {
+      out += ']';
+    }
+  }
+};
+
+// Member of a struct as a JSON object member
+template <typename T, typename M> struct json_field {
+  std::string_view name;
+  M T::*member;
+};
+
+template <typename T, typename M>
+json_field(const char *, M T::*) -> json_field<T, M>;
+
+// Base of the json_traits of a struct, which lists its members in
+//   static constexpr auto fields = std::make_tuple(json_field{"x", &T::x}, ..);
+// Missing members are a mismatch, unless they are optional
+template <typename T> struct json_object {
+  static constexpr std::string_view expected = "object";
+  static bool decode(detail::json_value v, T &out) {
+    if (!v || v.type() != detail::json_type::object) {
+      return false;
+    }
+    return std::apply(
+        [&](const auto &...field) {
+          return (decode_field(v, field, out) && ...);
+        },
+        json_traits<T>::fields);
+  }
+  static void encode(const T &in, std::string &out) {
+    out += '{';
+    std::apply(
+        [&](const auto &...field) { (encode_field(field, in, out), ...); },
+        json_traits<T>::fields);
+    if (out.back() == ',') {
+      out.back() = '}';
+    } else {
+      out += '}';
+    }
+  }
+
+private:
+  template <typename M>
+  static bool decode_field(detail::json_value v, const json_field<T, M> &field,
+                           T &out) {
+    return json_traits<M>::decode(v[field.name], out.*field.member);
+  }
+  template <typename M>
+  static void encode_field(const json_field<T, M> &field, const T &in,
+                           std::string &out) {
+    detail::json_escape(field.name, out);
+    out += ':';
+    json_traits<M>::encode(in.*field.member, out);
+    out += ',';
+  }
+};
+
+namespace detail {
+
+template <typename F> struct fn_signature;
+template <typename R, typename... A> struct fn_signature<R (*)(A...)> {
+  using result = R;
+  using args = std::tuple<std::remove_cvref_t<A>...>;
+};
+template <typename R, typename... A>
+struct fn_signature<R (*)(A...) noexcept> : fn_signature<R (*)(A...)> {};
+
+template <typename T> struct is_task : std::false_type {};
+template <typename T> struct is_task<task<T>> : std::true_type {
+  using result = T;
+};
+
+// Decoded argument of a typed binding
+template <typename T> struct json_arg {
+  T value;
+  bool decode(json_value v) { return json_traits<T>::decode(v, value); }
+};
+
+// A view of the request, unless the string has to be unescaped
+template <> struct json_arg<std::string_view> {
+  std::string_view value;
+  std::string unescaped;
+  bool decode(json_value v) {
+    if (!v || v.type() != json_type::string) {
+      return false;
+    }
+    if (json_unquote(v.raw(), value)) {
+      return true;
+    }
+    if (!json_unescape(v.raw(), unescaped)) {
+      return false;
+    }
+    value = unescaped;
+    return true;
+  }
+};
+
+template <typename T> void json_encode(const T &in, std::string &out) {
+  json_traits<T>::encode(in, out);
+}
+
+// Decodes the params of a call into args in a single parse. On mismatch,
+// returns false and the structured error of the reject
+template <typename... T>
+bool decode_params(std::string_view params, std::tuple<json_arg<T>...> &args,
+                   std::string &error) {
+  json_document doc;
+  if (!doc.parse(params) || doc.root().type() != json_type::array) {
+    error = R"({"code":-32602,"message":"invalid params",)"
+            R"("data":{"expected":"array"}})";
+    return false;
+  }
+  const auto root = doc.root();
+  if (root.size() > sizeof...(T)) {
+    error = R"({"code":-32602,"message":"too many arguments",)"
+            R"("data":{"arguments":)" +
+            std::to_string(sizeof...(T)) + "}}";
+    return false;
+  }
+  size_t failed = sizeof...(T);
+  std::string_view expected;
+  auto decode_one = [&](auto &arg, size_t i) {
+    using value_t = decltype(arg.value);
+    // a missing trailing argument is an invalid value: only optionals take it
+    if (arg.decode(i < root.size() ? root[i] : json_value{})) {
+      return true;
+    }
+    failed = i;
+    expected = json_traits<value_t>::expected;
+    return false;
+  };
+  const auto ok = std::apply(
+      [&](auto &...arg) {
+        size_t i = 0;
+        return (decode_one(arg, i++) && ...);
+      },
+      args);
+  if (!ok) {
+    error = R"({"code":-32602,"message":"invalid params",)"
+            R"("data":{"argument":)" +
+            std::to_string(failed) + R"(,"expected":)";
+    json_escape(expected, error);
+    error += "}}";
+  }
+  return ok;
+}
+
+} // namespace detail
+
+WEBVIEW_DEPRECATED_PRIVATE
+inline int json_parse_c(const char *s, size_t sz, const char *key, size_t keysz,
+                        const char **value, size_t *valuesz) {
+  return detail::json_parse_c(s, sz, key, keysz, value, valuesz);
+}
+
+WEBVIEW_DEPRECATED_PRIVATE
+inline std::string json_escape(const std::string &s) {
+  return detail::json_escape(s);
+}
+
+WEBVIEW_DEPRECATED_PRIVATE
+inline int json_unescape(const char *s, size_t n, char *out) {
+  return detail::json_unescape(s, n, out);
+}
+
+WEBVIEW_DEPRECATED_PRIVATE
+inline std::string json_parse(const std::string &s, const std::string &key,
+                              const int index) {
+  return detail::json_parse(s, key, index);
+}
+
+} // namespace webview
+
+#if 0 // defined(WEBVIEW_GTK)
+//
+// ====================================================================
+//
+// This implementation uses webkit2gtk backend. It requires gtk+3.0 and
+// webkit2gtk-4.0 libraries. Proper compiler flags can be retrieved via:
+//
+//   pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0
+//
+// ====================================================================
+//
+#include <JavaScriptCore/JavaScript.h>
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+namespace webview {
+namespace detail {
+
+class gtk_webkit_engine {
+public:
+  gtk_webkit_engine(bool debug, void *window)
+      : m_window(static_cast<GtkWidget *>(window)) {
+    if (gtk_init_check(0, NULL) == FALSE) {
+      return;
+    }
+    m_window = static_cast<GtkWidget *>(window);
+    if (m_window == nullptr) {
+      m_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    }
+    g_signal_connect(G_OBJECT(m_window), "destroy",
+                     G_CALLBACK(+[](GtkWidget *, gpointer arg) {
+                       static_cast<gtk_webkit_engine *>(arg)->terminate();
+                     }),
+                     this);
+    // Initialize webview widget
+    m_webview = webkit_web_view_new();
+    WebKitUserContentManager *manager =
+        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
+    g_signal_connect(manager, "script-message-received::external",
+                     G_CALLBACK(+[](WebKitUserContentManager *,
+                                    WebKitJavascriptResult *r, gpointer arg) {
+                       auto *w = static_cast<gtk_webkit_engine *>(arg);
+                       char *s = get_string_from_js_result(r);
+                       w->on_message(s);
+                       g_free(s);
+                     }),
+                     this);
+    webkit_user_content_manager_register_script_message_handler(manager,
+                                                                "external");
+    init("window.external={invoke:function(s){window.webkit.messageHandlers."
+         "external.postMessage(s);}}");
+
+    gtk_container_add(GTK_CONTAINER(m_window), GTK_WIDGET(m_webview));
+    gtk_widget_grab_focus(GTK_WIDGET(m_webview));
+
+    WebKitSettings *settings =
+        webkit_web_view_get_settings(WEBKIT_WEB_VIEW(m_webview));
+    webkit_settings_set_javascript_can_access_clipboard(settings, true);
+    if (debug) {
+      webkit_settings_set_enable_write_console_messages_to_stdout(settings,
+                                                                  true);
+      webkit_settings_set_enable_developer_extras(settings, true);
+    }
+
+    gtk_widget_show_all(m_window);
+  }
+  virtual ~gtk_webkit_engine() = default;
+  void *window() { return (void *)m_window; }
+  void run() { gtk_main(); }
+  void terminate() { gtk_main_quit(); }
+  void dispatch(std::function<void()> f) {
+    g_idle_add_full(G_PRIORITY_HIGH_IDLE, (GSourceFunc)([](void *f) -> int {
+                      (*static_cast<dispatch_fn_t *>(f))();
+                      return G_SOURCE_REMOVE;
+                    }),
+                    new std::function<void()>(f),
+                    [](void *f) { delete static_cast<dispatch_fn_t *>(f); });
+  }
+
+  void set_title(const std::string &title) {
+    gtk_window_set_title(GTK_WINDOW(m_window), title.c_str());
+  }
+
+  void set_size(int width, int height, int hints) {
+    gtk_window_set_resizable(GTK_WINDOW(m_window), hints != WEBVIEW_HINT_FIXED);
+    if (hints == WEBVIEW_HINT_NONE) {
+      gtk_window_resize(GTK_WINDOW(m_window), width, height);
+    } else if (hints == WEBVIEW_HINT_FIXED) {
+      gtk_widget_set_size_request(m_window, width, height);
+    } else {
+      GdkGeometry g;
+      g.min_width = g.max_width = width;
+      g.min_height = g.max_height = height;
+      GdkWindowHints h =
+          (hints == WEBVIEW_HINT_MIN ? GDK_HINT_MIN_SIZE : GDK_HINT_MAX_SIZE);
+      // This defines either MIN_SIZE, or MAX_SIZE, but not both:
+      gtk_window_set_geometry_hints(GTK_WINDOW(m_window), nullptr, &g, h);
+    }
+  }
+
+  void navigate(const std::string &url) {
+    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(m_webview), url.c_str());
+  }
+
+  void set_html(const std::string &html) {
+    webkit_web_view_load_html(WEBKIT_WEB_VIEW(m_webview), html.c_str(), NULL);
+  }
+
+  void init(const std::string &js) {
+    WebKitUserContentManager *manager =
+        webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
+    webkit_user_content_manager_add_script(
+        manager, webkit_user_script_new(
+                     js.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                     WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL));
+  }
+
+  void eval(const std::string &js) {
+    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(m_webview), js.c_str(), NULL,
+                                   NULL, NULL);
+  }
+
+private:
+  virtual void on_message(const std::string &msg) = 0;
+
+  static char *get_string_from_js_result(WebKitJavascriptResult *r) {
+    char *s;
+#if WEBKIT_MAJOR_VERSION >= 2 && WEBKIT_MINOR_VERSION >= 22
+    JSCValue *value = webkit_javascript_result_get_js_value(r);
+    s = jsc_value_to_string(value);
+#else
+    JSGlobalContextRef ctx = webkit_javascript_result_get_global_context(r);
+    JSValueRef value = webkit_javascript_result_get_value(r);
+    JSStringRef js = JSValueToStringCopy(ctx, value, NULL);
+    size_t n = JSStringGetMaximumUTF8CStringSize(js);
+    s = g_new(char, n);
+    JSStringGetUTF8CString(js, s, n);
+    JSStringRelease(js);
+#endif
+    return s;
+  }
+
+  GtkWidget *m_window;
+  GtkWidget *m_webview;
+};
+
+} // namespace detail
+
+using browser_engine = detail::gtk_webkit_engine;
+
+} // namespace webview
+
+#elif 0 // defined(WEBVIEW_COCOA)
+
+//
+// ====================================================================
+//
+// This implementation uses Cocoa WKWebView backend on macOS. It is
+// written using ObjC runtime and uses WKWebView class as a browser runtime.
+// You should pass "-framework Webkit" flag to the compiler.
+//
+// ====================================================================
+//
+
+#include <CoreGraphics/CoreGraphics.h>
+#include <objc/NSObjCRuntime.h>
+#include <objc/objc-runtime.h>
+
+namespace webview {
+namespace detail {
+namespace objc {
+
+// A convenient template function for unconditionally casting the specified
+// C-like function into a function that can be called with the given return
+// type and arguments. Caller takes full responsibility for ensuring that
+// the function call is valid. It is assumed that the function will not
+// throw exceptions.
+template <typename Result, typename Callable, typename... Args>
+Result invoke(Callable callable, Args... args) noexcept {
+  return reinterpret_cast<Result (*)(Args...)>(callable)(args...);
+}
+
+// Calls objc_msgSend.
+template <typename Result, typename... Args>
+Result msg_send(Args... args) noexcept {
+  return invoke<Result>(objc_msgSend, args...);
+}
+
+} // namespace objc
+
+enum NSBackingStoreType : NSUInteger { NSBackingStoreBuffered = 2 };
+
+enum NSWindowStyleMask : NSUInteger {
+  NSWindowStyleMaskTitled = 1,
+  NSWindowStyleMaskClosable = 2,
+  NSWindowStyleMaskMiniaturizable = 4,
+  NSWindowStyleMaskResizable = 8
+};
+
+enum NSApplicationActivationPolicy : NSInteger {
+  NSApplicationActivationPolicyRegular = 0
+};
+
+enum WKUserScriptInjectionTime : NSInteger {
+  WKUserScriptInjectionTimeAtDocumentStart = 0
+};
+
+enum NSModalResponse : NSInteger { NSModalResponseOK = 1 };
+
+// Convenient conversion of string literals.
+id operator"" _cls(const char *s, std::size_t) { return (id)objc_getClass(s); }
+SEL operator"" _sel(const char *s, std::size_t) { return sel_registerName(s); }
+id operator"" _str(const char *s, std::size_t) {
+  return objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel, s);
+}
+
+class cocoa_wkwebview_engine {
+public:
+  cocoa_wkwebview_engine(bool debug, void *window)
+      : m_debug{debug}, m_parent_window{window} {
+    auto app = get_shared_application();
+    auto delegate = create_app_delegate();
+    objc_setAssociatedObject(delegate, "webview", (id)this,
+                             OBJC_ASSOCIATION_ASSIGN);
+    objc::msg_send<void>(app, "setDelegate:"_sel, delegate);
+
+    // Start the main run loop so that the app delegate gets the
+    // NSApplicationDidFinishLaunchingNotification notification after the run
+    // loop has started in order to perform further initialization.
+    // We need to return from this constructor so this run loop is only
+    // temporary.
+    objc::msg_send<void>(app, "run"_sel);
+  }
+  virtual ~cocoa_wkwebview_engine() = default;
+  void *window() { return (void *)m_window; }
+  void terminate() {
+    auto app = get_shared_application();
+    objc::msg_send<void>(app, "terminate:"_sel, nullptr);
+  }
+  void run() {
+    auto app = get_shared_application();
+    objc::msg_send<void>(app, "run"_sel);
+  }
+  void dispatch(std::function<void()> f) {
+    dispatch_async_f(dispatch_get_main_queue(), new dispatch_fn_t(f),
+                     (dispatch_function_t)([](void *arg) {
+                       auto f = static_cast<dispatch_fn_t *>(arg);
+                       (*f)();
+                       delete f;
+                     }));
+  }
+  void set_title(const std::string &title) {
+    objc::msg_send<void>(m_window, "setTitle:"_sel,
+                         objc::msg_send<id>("NSString"_cls,
+                                            "stringWithUTF8String:"_sel,
+                                            title.c_str()));
+  }
+  void set_size(int width, int height, int hints) {
+    auto style = static_cast<NSWindowStyleMask>(
+        NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
+        NSWindowStyleMaskMiniaturizable);
+    if (hints != WEBVIEW_HINT_FIXED) {
+      style =
+          static_cast<NSWindowStyleMask>(style | NSWindowStyleMaskResizable);
+    }
+    objc::msg_send<void>(m_window, "setStyleMask:"_sel, style);
+
+    if (hints == WEBVIEW_HINT_MIN) {
+      objc::msg_send<void>(m_window, "setContentMinSize:"_sel,
+                           CGSizeMake(width, height));
+    } else if (hints == WEBVIEW_HINT_MAX) {
+      objc::msg_send<void>(m_window, "setContentMaxSize:"_sel,
+                           CGSizeMake(width, height));
+    } else {
+      objc::msg_send<void>(m_window, "setFrame:display:animate:"_sel,
+                           CGRectMake(0, 0, width, height), YES, NO);
+    }
+    objc::msg_send<void>(m_window, "center"_sel);
+  }
+  void navigate(const std::string &url) {
+    auto nsurl = objc::msg_send<id>(
+        "NSURL"_cls, "URLWithString:"_sel,
+        objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
+                           url.c_str()));
+
+    objc::msg_send<void>(
+        m_webview, "loadRequest:"_sel,
+        objc::msg_send<id>("NSURLRequest"_cls, "requestWithURL:"_sel, nsurl));
+  }
+  void set_html(const std::string &html) {
+    objc::msg_send<void>(m_webview, "loadHTMLString:baseURL:"_sel,
+                         objc::msg_send<id>("NSString"_cls,
+                                            "stringWithUTF8String:"_sel,
+                                            html.c_str()),
+                         nullptr);
+  }
+  void init(const std::string &js) {
+    // Equivalent Obj-C:
+    // [m_manager addUserScript:[[WKUserScript alloc] initWithSource:[NSString stringWithUTF8String:js.c_str()] injectionTime:WKUserScriptInjectionTimeAtDocumentStart forMainFrameOnly:YES]]
+    objc::msg_send<void>(
+        m_manager, "addUserScript:"_sel,
+        objc::msg_send<id>(objc::msg_send<id>("WKUserScript"_cls, "alloc"_sel),
+                           "initWithSource:injectionTime:forMainFrameOnly:"_sel,
+                           objc::msg_send<id>("NSString"_cls,
+                                              "stringWithUTF8String:"_sel,
+                                              js.c_str()),
+                           WKUserScriptInjectionTimeAtDocumentStart, YES));
+  }
+  void eval(const std::string &js) {
+    objc::msg_send<void>(m_webview, "evaluateJavaScript:completionHandler:"_sel,
+                         objc::msg_send<id>("NSString"_cls,
+                                            "stringWithUTF8String:"_sel,
+                                            js.c_str()),
+                         nullptr);
+  }
+
+private:
+  virtual void on_message(const std::string &msg) = 0;
+  static id create_app_delegate() {
+    auto cls =
+        objc_allocateClassPair((Class) "NSResponder"_cls, "AppDelegate", 0);
+    class_addProtocol(cls, objc_getProtocol("NSTouchBarProvider"));
+    class_addMethod(cls, "applicationShouldTerminateAfterLastWindowClosed:"_sel,
+                    (IMP)(+[](id, SEL, id) -> BOOL { return 1; }), "c@:@");
+    class_addMethod(
+        cls, "userContentController:didReceiveScriptMessage:"_sel,
+        (IMP)(+[](id self, SEL, id, id msg) {
+          auto w = get_associated_webview(self);
+          w->on_message(((const char *(*)(id, SEL))objc_msgSend)(
+              objc::msg_send<id>(msg, "body"_sel), "UTF8String"_sel));
+        }),
+        "v@:@@");
+    class_addMethod(cls, "applicationDidFinishLaunching:"_sel,
+                    (IMP)(+[](id self, SEL, id notification) {
+                      auto app = objc::msg_send<id>(notification, "object"_sel);
+                      auto w = get_associated_webview(self);
+                      w->on_application_did_finish_launching(self, app);
+                    }),
+                    "v@:@");
+    objc_registerClassPair(cls);
+    return objc::msg_send<id>((id)cls, "new"_sel);
+  }
+  static id create_webkit_ui_delegate() {
+    auto cls =
+        objc_allocateClassPair((Class) "NSObject"_cls, "WebkitUIDelegate", 0);
+    class_addProtocol(cls, objc_getProtocol("WKUIDelegate"));
+    class_addMethod(
+        cls,
+        "webView:runOpenPanelWithParameters:initiatedByFrame:completionHandler:"_sel,
+        (IMP)(+[](id, SEL, id, id parameters, id, id completion_handler) {
+          auto allows_multiple_selection =
+              objc::msg_send<BOOL>(parameters, "allowsMultipleSelection"_sel);
+          auto allows_directories =
+              objc::msg_send<BOOL>(parameters, "allowsDirectories"_sel);
+
+          // Show a panel for selecting files.
+          auto panel = objc::msg_send<id>("NSOpenPanel"_cls, "openPanel"_sel);
+          objc::msg_send<void>(panel, "setCanChooseFiles:"_sel, YES);
+          objc::msg_send<void>(panel, "setCanChooseDirectories:"_sel,
+                               allows_directories);
+          objc::msg_send<void>(panel, "setAllowsMultipleSelection:"_sel,
+                               allows_multiple_selection);
+          auto modal_response =
+              objc::msg_send<NSModalResponse>(panel, "runModal"_sel);
+
+          // Get the URLs for the selected files. If the modal was canceled
+          // then we pass null to the completion handler to signify
+          // cancellation.
+          id urls = modal_response == NSModalResponseOK
+                        ? objc::msg_send<id>(panel, "URLs"_sel)
+                        : nullptr;
+
+          // Invoke the completion handler block.
+          auto sig = objc::msg_send<id>("NSMethodSignature"_cls,
+                                        "signatureWithObjCTypes:"_sel, "v@?@");
+          auto invocation = objc::msg_send<id>(
+              "NSInvocation"_cls, "invocationWithMethodSignature:"_sel, sig);
+          objc::msg_send<void>(invocation, "setTarget:"_sel,
+                               completion_handler);
+          objc::msg_send<void>(invocation, "setArgument:atIndex:"_sel, &urls,
+                               1);
+          objc::msg_send<void>(invocation, "invoke"_sel);
+        }),
+        "v@:@@@@");
+    objc_registerClassPair(cls);
+    return objc::msg_send<id>((id)cls, "new"_sel);
+  }
+  static id get_shared_application() {
+    return objc::msg_send<id>("NSApplication"_cls, "sharedApplication"_sel);
+  }
+  static cocoa_wkwebview_engine *get_associated_webview(id object) {
+    auto w =
+        (cocoa_wkwebview_engine *)objc_getAssociatedObject(object, "webview");
+    assert(w);
+    return w;
+  }
+  static id get_main_bundle() noexcept {
+    return objc::msg_send<id>("NSBundle"_cls, "mainBundle"_sel);
+  }
+  static bool is_app_bundled() noexcept {
+    auto bundle = get_main_bundle();
+    if (!bundle) {
+      return false;
+    }
+    auto bundle_path = objc::msg_send<id>(bundle, "bundlePath"_sel);
+    auto bundled =
+        objc::msg_send<BOOL>(bundle_path, "hasSuffix:"_sel, ".app"_str);
+    return !!bundled;
+  }
+  void on_application_did_finish_launching(id delegate, id app) {
+    // Stop the main run loop so that we can return
+    // from the constructor.
+    objc::msg_send<void>(app, "stop:"_sel, nullptr);
+
+    // Activate the app if it is not bundled.
+    // Bundled apps launched from Finder are activated automatically but
+    // otherwise not. Activating the app even when it has been launched from
+    // Finder does not seem to be harmful but calling this function is rarely
+    // needed as proper activation is normally taken care of for us.
+    // Bundled apps have a default activation policy of
+    // NSApplicationActivationPolicyRegular while non-bundled apps have a
+    // default activation policy of NSApplicationActivationPolicyProhibited.
+    if (!is_app_bundled()) {
+      // "setActivationPolicy:" must be invoked before
+      // "activateIgnoringOtherApps:" for activation to work.
+      objc::msg_send<void>(app, "setActivationPolicy:"_sel,
+                           NSApplicationActivationPolicyRegular);
+      // Activate the app regardless of other active apps.
+      // This can be obtrusive so we only do it when necessary.
+      objc::msg_send<void>(app, "activateIgnoringOtherApps:"_sel, YES);
+    }
+
+    // Main window
+    if (!m_parent_window) {
+      m_window = objc::msg_send<id>("NSWindow"_cls, "alloc"_sel);
+      auto style = NSWindowStyleMaskTitled;
+      m_window = objc::msg_send<id>(
+          m_window, "initWithContentRect:styleMask:backing:defer:"_sel,
+          CGRectMake(0, 0, 0, 0), style, NSBackingStoreBuffered, NO);
+    } else {
+      m_window = (id)m_parent_window;
+    }
+
+    // Webview
+    auto config = objc::msg_send<id>("WKWebViewConfiguration"_cls, "new"_sel);
+    m_manager = objc::msg_send<id>(config, "userContentController"_sel);
+    m_webview = objc::msg_send<id>("WKWebView"_cls, "alloc"_sel);
+
+    if (m_debug) {
+      // Equivalent Obj-C:
+      // [[config preferences] setValue:@YES forKey:@"developerExtrasEnabled"];
+      objc::msg_send<id>(
+          objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+          objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+          "developerExtrasEnabled"_str);
+    }
+
+    // Equivalent Obj-C:
+    // [[config preferences] setValue:@YES forKey:@"fullScreenEnabled"];
+    objc::msg_send<id>(
+        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+        "fullScreenEnabled"_str);
+
+    // Equivalent Obj-C:
+    // [[config preferences] setValue:@YES forKey:@"javaScriptCanAccessClipboard"];
+    objc::msg_send<id>(
+        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+        "javaScriptCanAccessClipboard"_str);
+
+    // Equivalent Obj-C:
+    // [[config preferences] setValue:@YES forKey:@"DOMPasteAllowed"];
+    objc::msg_send<id>(
+        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+        "DOMPasteAllowed"_str);
+
+    auto ui_delegate = create_webkit_ui_delegate();
+    objc::msg_send<void>(m_webview, "initWithFrame:configuration:"_sel,
+                         CGRectMake(0, 0, 0, 0), config);
+    objc::msg_send<void>(m_webview, "setUIDelegate:"_sel, ui_delegate);
+    objc::msg_send<void>(m_manager, "addScriptMessageHandler:name:"_sel,
+                         delegate, "external"_str);
+
+    init(R"script(
+      window.external = {
+        invoke: function(s) {
+          window.webkit.messageHandlers.external.postMessage(s);
+        },
+      };
+      )script");
+    objc::msg_send<void>(m_window, "setContentView:"_sel, m_webview);
+    objc::msg_send<void>(m_window, "makeKeyAndOrderFront:"_sel, nullptr);
+  }
+  bool m_debug;
+  void *m_parent_window;
+  id m_window;
+  id m_webview;
+  id m_manager;
+};
+
+} // namespace detail
+
+using browser_engine = detail::cocoa_wkwebview_engine;
+
+} // namespace webview
+
+#elif defined(WEBVIEW_HEADLESS)
+
+//
+// ====================================================================
+//
+// ilpropheta: this implementation has neither a window nor a browser, so
+// that bindings can be tested and benchmarked anywhere. It runs a real event
+// loop (dispatch, run and terminate behave like the other engines) and keeps
+// what would reach the browser; a scripted page plays the part of the JS side
+// and talks back with post_message, as window.external.invoke would.
+//
+// ====================================================================
+//
+
+namespace webview {
+namespace detail {
+
+class headless_engine {
+public:
+  // What the page sees, on the loop thread: a new document (its init scripts
+  // have run), every script evaluated in it and every web message posted to
+  // it (JSON text)
+  struct page_script {
+    std::function<void(const std::string &url)> on_document;
+    std::function<void(const std::string &js)> on_eval;
+    std::function<void(const std::string &json)> on_web_message;
+  };
+
+  headless_engine(bool, void *window) : m_window(window ? window : this) {}
+  virtual ~headless_engine() = default;
+
+  headless_engine(const headless_engine &other) = delete;
+  headless_engine &operator=(const headless_engine &other) = delete;
+  headless_engine(headless_engine &&other) = delete;
+  headless_engine &operator=(headless_engine &&other) = delete;
+
+  void run() {
+    std::unique_lock lock{m_mutex};
+    for (;;) {
+      m_wakeup.wait(lock, [this] { return m_quit || m_wakeups; });
+      if (std::exchange(m_quit, false)) {
+        return;
+      }
+      m_wakeups = false;
+      lock.unlock();
+      if (m_dispatch_queue.drain()) {
+        post_wakeup();
+      }
+      lock.lock();
+    }
+  }
+  void *window() { return m_window; }
+  void terminate() {
+    std::lock_guard lock{m_mutex};
+    m_quit = true;
+    m_wakeup.notify_one();
+  }
+  void dispatch(dispatch_fn_t f, dispatch_lane lane = dispatch_lane::normal) {
+    if (m_dispatch_queue.push(std::move(f), lane)) {
+      post_wakeup();
+    }
+  }
+
+  void set_title(const std::string &title) { m_title = title; }
+
+  void set_size(int width, int height, int hints) {
+    m_size = {width, height, hints};
+  }
+
+  // The new document is loaded asynchronously, as it is by a browser
+  void navigate(const std::string &url) {
+    dispatch([this, url] {
+      m_url = url;
+      if (m_page.on_document) {
+        m_page.on_document(url);
+      }
+    });
+  }
+
+  void set_html(const std::string &html) { navigate("data:text/html," + html); }
+
+  void init(const std::string &js) { m_inits.push_back(js); }
+
+  void eval(const std::string &js) {
+    m_evals.push_back(js);
+    if (m_page.on_eval) {
+      m_page.on_eval(js);
+    }
+  }
+
+  // Unless web messages are disabled, to compare them with eval
+  bool post_web_message(const std::string &json) {
+    if (!m_web_messages) {
+      return false;
+    }
+    m_posted.push_back(json);
+    if (m_page.on_web_message) {
+      m_page.on_web_message(json);
+    }
+    return true;
+  }
+
+  // There is no binary transport: binary calls arrive in chunks and are
+  // resolved by eval
+  bool binary_reply(const std::string &, int, std::span<const std::byte>) {
+    return false;
+  }
+  void cancel_binary_requests() {}
+
+  // Set before run
+  void set_page(page_script page) { m_page = std::move(page); }
+  void set_web_messages(bool enabled) { m_web_messages = enabled; }
+
+  // From the page, any thread: msg is delivered on the loop thread
+  void post_message(std::string msg) {
+    dispatch([this, msg = std::move(msg)] { on_message(msg); });
+  }
+
+  // What reached the browser so far, on the loop thread (or once run is over)
+  const std::string &url() const { return m_url; }
+  const std::string &title() const { return m_title; }
+  std::array<int, 3> size() const { return m_size; }
+  const std::vector<std::string> &inits() const { return m_inits; }
+  // Scripts evaluated (and web messages posted) since the last call
+  std::vector<std::string> take_evals() { return std::exchange(m_evals, {}); }
+  std::vector<std::string> take_web_messages() {
+    return std::exchange(m_posted, {});
+  }
+
+private:
+  void post_wakeup() {
+    std::lock_guard lock{m_mutex};
+    m_wakeups = true;
+    m_wakeup.notify_one();
+  }
+
+  virtual void on_message(const std::string &msg) = 0;
+  virtual void on_binary_message(const std::string &seq,
+                                 const std::string &name,
+                                 std::span<const std::byte> data) = 0;
+
+  void *m_window;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  bool m_wakeups = false;
+  bool m_quit = false;
+  dispatch_queue m_dispatch_queue;
+  page_script m_page;
+  std::string m_url;
+  std::string m_title;
+  std::array<int, 3> m_size{};
+  std::vector<std::string> m_inits;
+  std::vector<std::string> m_evals;
+  std::vector<std::string> m_posted;
+  bool m_web_messages = true;
+};
+
+} // namespace detail
+
+using browser_engine = detail::headless_engine;
+
+} // namespace webview
+
+#elif defined(WEBVIEW_EDGE)
+
+//
+// ====================================================================
+//
+// This implementation uses Win32 API to create a native window. It
+// uses Edge/Chromium webview2 backend as a browser engine.
+//
+// ====================================================================
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "WebView2.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "user32.lib")
+#endif
+
+namespace webview {
+namespace detail {
+
+using msg_cb_t = std::function<void(const std::string &)>; // ilpropheta: by reference
+using resource_cb_t =
+    std::function<void(ICoreWebView2WebResourceRequestedEventArgs *)>;
+
+// ilpropheta: calls of binary bindings are POSTed here
+constexpr auto binary_url = L"https://webview.binary/";
+
+// Converts a narrow (UTF-8-encoded) string into a wide (UTF-16-encoded) string.
+inline std::wstring widen_string(const std::string &input) {
+  if (input.empty()) {
+    return std::wstring();
+  }
+  UINT cp = CP_UTF8;
+  DWORD flags = MB_ERR_INVALID_CHARS;
+  auto input_c = input.c_str();
+  auto input_length = static_cast<int>(input.size());
+  auto required_length =
+      MultiByteToWideChar(cp, flags, input_c, input_length, nullptr, 0);
+  if (required_length > 0) {
+    std::wstring output(static_cast<std::size_t>(required_length), L'\0');
+    if (MultiByteToWideChar(cp, flags, input_c, input_length, &output[0],
+                            required_length) > 0) {
+      return output;
+    }
+  }
+  // Failed to convert string from UTF-8 to UTF-16
+  return std::wstring();
+}
+
+// Converts a wide (UTF-16-encoded) string into a narrow (UTF-8-encoded) string.
+inline std::string narrow_string(const std::wstring &input) {
+  if (input.empty()) {
+    return std::string();
+  }
+  UINT cp = CP_UTF8;
+  DWORD flags = WC_ERR_INVALID_CHARS;
+  auto input_c = input.c_str();
+  auto input_length = static_cast<int>(input.size());
+  auto required_length = WideCharToMultiByte(cp, flags, input_c, input_length,
+                                             nullptr, 0, nullptr, nullptr);
+  if (required_length > 0) {
+    std::string output(static_cast<std::size_t>(required_length), '\0');
+    if (WideCharToMultiByte(cp, flags, input_c, input_length, &output[0],
+                            required_length, nullptr, nullptr) > 0) {
+      return output;
+    }
+  }
+  // Failed to convert string from UTF-16 to UTF-8
+  return std::string();
+}
+
+// A wrapper around COM library initialization. Calls CoInitializeEx in the
+// constructor and CoUninitialize in the destructor.
+class com_init_wrapper {
+public:
+  com_init_wrapper(DWORD dwCoInit) {
+    // We can safely continue as long as COM was either successfully
+    // initialized or already initialized.
+    // RPC_E_CHANGED_MODE means that CoInitializeEx was already called with
+    // a different concurrency model.
+    switch (CoInitializeEx(nullptr, dwCoInit)) {
+    case S_OK:
+    case S_FALSE:
+      m_initialized = true;
+      break;
+    }
+  }
+
+  ~com_init_wrapper() {
+    if (m_initialized) {
+      CoUninitialize();
+      m_initialized = false;
+    }
+  }
+
+  com_init_wrapper(const com_init_wrapper &other) = delete;
+  com_init_wrapper &operator=(const com_init_wrapper &other) = delete;
+  com_init_wrapper(com_init_wrapper &&other) = delete;
+  com_init_wrapper &operator=(com_init_wrapper &&other) = delete;
+
+  bool is_initialized() const { return m_initialized; }
+
+private:
+  bool m_initialized = false;
+};
+
+// Holds a symbol name and associated type for code clarity.
+template <typename T> class library_symbol {
+public:
+  using type = T;
+
+  constexpr explicit library_symbol(const char *name) : m_name(name) {}
+  constexpr const char *get_name() const { return m_name; }
+
+private:
+  const char *m_name;
+};
+
+// Loads a native shared library and allows one to get addresses for those
+// symbols.
+class native_library {
+public:
+  explicit native_library(const wchar_t *name) : m_handle(LoadLibraryW(name)) {}
+
+  ~native_library() {
+    if (m_handle) {
+      FreeLibrary(m_handle);
+      m_handle = nullptr;
+    }
+  }
+
+  native_library(const native_library &other) = delete;
+  native_library &operator=(const native_library &other) = delete;
+  native_library(native_library &&other) = default;
+  native_library &operator=(native_library &&other) = default;
+
+  // Returns true if the library is currently loaded; otherwise false.
+  operator bool() const { return is_loaded(); }
+
+  // Get the address for the specified symbol or nullptr if not found.
+  template <typename Symbol>
+  typename Symbol::type get(const Symbol &symbol) const {
+    if (is_loaded()) {
+      return reinterpret_cast<typename Symbol::type>(
+          GetProcAddress(m_handle, symbol.get_name()));
+    }
+    return nullptr;
+  }
+
+  // Returns true if the library is currently loaded; otherwise false.
+  bool is_loaded() const { return !!m_handle; }
+
+private:
+  HMODULE m_handle = nullptr;
+};
+
+struct user32_symbols {
+  using DPI_AWARENESS_CONTEXT = HANDLE;
+  using SetProcessDpiAwarenessContext_t = BOOL(WINAPI *)(DPI_AWARENESS_CONTEXT);
+
+  static constexpr auto SetProcessDpiAwarenessContext =
+      library_symbol<SetProcessDpiAwarenessContext_t>(
+          "SetProcessDpiAwarenessContext");
+  static constexpr auto SetProcessDPIAware =
+      library_symbol<decltype(&::SetProcessDPIAware)>("SetProcessDPIAware");
+};
+
+struct shcore_symbols {
+  typedef enum { PROCESS_PER_MONITOR_DPI_AWARE = 2 } PROCESS_DPI_AWARENESS;
+  using SetProcessDpiAwareness_t = HRESULT(WINAPI *)(PROCESS_DPI_AWARENESS);
+
+  static constexpr auto SetProcessDpiAwareness =
+      library_symbol<SetProcessDpiAwareness_t>("SetProcessDpiAwareness");
+};
+
+inline bool enable_dpi_awareness() {
+  auto user32 = native_library(L"user32.dll");
+  if (auto fn = user32.get(user32_symbols::SetProcessDpiAwarenessContext)) {
+    if (fn(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE)) {
+      return true;
+    }
+    return GetLastError() == ERROR_ACCESS_DENIED;
+  }
+  if (auto shcore = native_library(L"shcore.dll")) {
+    if (auto fn = shcore.get(shcore_symbols::SetProcessDpiAwareness)) {
+      auto result = fn(shcore_symbols::PROCESS_PER_MONITOR_DPI_AWARE);
+      return result == S_OK || result == E_ACCESSDENIED;
+    }
+  }
+  if (auto fn = user32.get(user32_symbols::SetProcessDPIAware)) {
+    return !!fn();
+  }
+  return true;
+}
+
+class webview2_com_handler
+    : public ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler,
+      public ICoreWebView2CreateCoreWebView2ControllerCompletedHandler,
+      public ICoreWebView2WebMessageReceivedEventHandler,
+      public ICoreWebView2PermissionRequestedEventHandler,
+      public ICoreWebView2WebResourceRequestedEventHandler {
+  using webview2_com_handler_cb_t =
+      std::function<void(ICoreWebView2Controller *, ICoreWebView2 *webview)>;
+
+public:
+  webview2_com_handler(HWND hwnd, msg_cb_t msgCb, resource_cb_t resourceCb,
+                       webview2_com_handler_cb_t cb)
+      : m_window(hwnd), m_msgCb(msgCb), m_resourceCb(resourceCb), m_cb(cb) {}
+
+  virtual ~webview2_com_handler() {
+    if (m_env) {
+      m_env->Release();
+    }
+  }
+  webview2_com_handler(const webview2_com_handler &other) = delete;
+  webview2_com_handler &operator=(const webview2_com_handler &other) = delete;
+  webview2_com_handler(webview2_com_handler &&other) = delete;
+  webview2_com_handler &operator=(webview2_com_handler &&other) = delete;
+
+  ULONG STDMETHODCALLTYPE AddRef() { return ++m_ref_count; }
+  ULONG STDMETHODCALLTYPE Release() {
+    if (m_ref_count > 1) {
+      return --m_ref_count;
+    }
+    delete this;
+    return 0;
+  }
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, LPVOID *ppv) {
+    if (!ppv) {
+      return E_POINTER;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+  HRESULT STDMETHODCALLTYPE Invoke(HRESULT res, ICoreWebView2Environment *env) {
+    env->AddRef();
+    m_env = env;
+    env->CreateCoreWebView2Controller(m_window, this);
+    return S_OK;
+  }
+  HRESULT STDMETHODCALLTYPE Invoke(HRESULT res,
+                                   ICoreWebView2Controller *controller) {
+    ICoreWebView2 *webview;
+    ::EventRegistrationToken token;
+    controller->get_CoreWebView2(&webview);
+    webview->add_WebMessageReceived(this, &token);
+    webview->add_PermissionRequested(this, &token);
+    webview->add_WebResourceRequested(this, &token);
+    webview->AddWebResourceRequestedFilter(
+        (std::wstring(binary_url) + L"*").c_str(),
+        COREWEBVIEW2_WEB_RESOURCE_CONTEXT_ALL);
+
+    m_cb(controller, webview);
+    return S_OK;
+  }
+  HRESULT STDMETHODCALLTYPE Invoke(
+      ICoreWebView2 *sender, ICoreWebView2WebMessageReceivedEventArgs *args) {
+    LPWSTR message;
+    args->TryGetWebMessageAsString(&message);
+    m_msgCb(narrow_string(message)); // ilpropheta: no longer echoed to the page
+
+    CoTaskMemFree(message);
+    return S_OK;
+  }
+  HRESULT STDMETHODCALLTYPE Invoke(
+      ICoreWebView2 *sender, ICoreWebView2PermissionRequestedEventArgs *args) {
+    COREWEBVIEW2_PERMISSION_KIND kind;
+    args->get_PermissionKind(&kind);
+    if (kind == COREWEBVIEW2_PERMISSION_KIND_CLIPBOARD_READ) {
+      args->put_State(COREWEBVIEW2_PERMISSION_STATE_ALLOW);
+    }
+    return S_OK;
+  }
+  HRESULT STDMETHODCALLTYPE Invoke(
+      ICoreWebView2 *sender, ICoreWebView2WebResourceRequestedEventArgs *args) {
+    m_resourceCb(args);
+    return S_OK;
+  }
+
+  ICoreWebView2Environment *environment() const { return m_env; }
+
+private:
+  HWND m_window;
+  msg_cb_t m_msgCb;
+  resource_cb_t m_resourceCb;
+  webview2_com_handler_cb_t m_cb;
+  ICoreWebView2Environment *m_env = nullptr;
+  std::atomic<ULONG> m_ref_count{1};
+};
+
+class win32_edge_engine {
+public:
+  win32_edge_engine(bool debug, void *window) {
+    if (!is_webview2_available()) {
+      return;
+    }
+    if (!m_com_init.is_initialized()) {
+      return;
+    }
+    enable_dpi_awareness();
+    if (window == nullptr) {
+      HINSTANCE hInstance = GetModuleHandle(nullptr);
+      HICON icon = (HICON)LoadImage(
+          hInstance, IDI_APPLICATION, IMAGE_ICON, GetSystemMetrics(SM_CXICON),
+          GetSystemMetrics(SM_CYICON), LR_DEFAULTCOLOR);
+
+      WNDCLASSEXW wc;
+      ZeroMemory(&wc, sizeof(WNDCLASSEX));
+      wc.cbSize = sizeof(WNDCLASSEX);
+      wc.hInstance = hInstance;
+      wc.lpszClassName = L"webview";
+      wc.hIcon = icon;
+      wc.lpfnWndProc =
+          (WNDPROC)(+[](HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) -> LRESULT {
+            auto w = (win32_edge_engine *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+            switch (msg) {
+            case WM_SIZE:
+              w->resize(hwnd);
+              break;
+            case WM_CLOSE:
+              DestroyWindow(hwnd);
+              break;
+            case WM_DESTROY:
+              w->terminate();
+              break;
+            // ilpropheta: wakeups are window messages, so that the modal
+            // loops of moving, resizing, menus and message boxes dispatch
+            // them too (they would drop thread messages)
+            case WM_APP:
+              if (w) {
+                w->drain_dispatch();
+              }
+              break;
+            case WM_TIMER:
+              if (w && wp == wakeup_timer) {
+                w->drain_dispatch();
+                break;
+              }
+              return DefWindowProcW(hwnd, msg, wp, lp);
+            case WM_GETMINMAXINFO: {
+              auto lpmmi = (LPMINMAXINFO)lp;
+              if (w == nullptr) {
+                return 0;
+              }
+              if (w->m_maxsz.x > 0 && w->m_maxsz.y > 0) {
+                lpmmi->ptMaxSize = w->m_maxsz;
+                lpmmi->ptMaxTrackSize = w->m_maxsz;
+              }
+              if (w->m_minsz.x > 0 && w->m_minsz.y > 0) {
+                lpmmi->ptMinTrackSize = w->m_minsz;
+              }
+            } break;
+            default:
+              return DefWindowProcW(hwnd, msg, wp, lp);
+            }
+            return 0;
+          });
+      RegisterClassExW(&wc);
+      m_window = CreateWindowW(L"webview", L"", WS_OVERLAPPEDWINDOW,
+                               CW_USEDEFAULT, CW_USEDEFAULT, 640, 480, nullptr,
+                               nullptr, hInstance, nullptr);
+      if (m_window == nullptr) {
+        return;
+      }
+      SetWindowLongPtr(m_window, GWLP_USERDATA, (LONG_PTR)this);
+    } else {
+      m_window = *(static_cast<HWND *>(window));
+    }
+
+    ShowWindow(m_window, SW_SHOW);
+    UpdateWindow(m_window);
+    SetFocus(m_window);
+
+    auto cb =
+        std::bind(&win32_edge_engine::on_message, this, std::placeholders::_1);
+
+    embed(m_window, debug, cb);
+    resize(m_window);
+    m_controller->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+  }
+
+  virtual ~win32_edge_engine() {
+    for (auto &[seq, request] : m_binary_requests) {
+      request.deferral->Complete();
+      request.deferral->Release();
+      request.args->Release();
+    }
+    if (m_com_handler) {
+      m_com_handler->Release();
+      m_com_handler = nullptr;
+    }
+    if (m_webview) {
+      m_webview->Release();
+      m_webview = nullptr;
+    }
+    if (m_controller) {
+      m_controller->Release();
+      m_controller = nullptr;
+    }
+  }
+
+  win32_edge_engine(const win32_edge_engine &other) = delete;
+  win32_edge_engine &operator=(const win32_edge_engine &other) = delete;
+  win32_edge_engine(win32_edge_engine &&other) = delete;
+  win32_edge_engine &operator=(win32_edge_engine &&other) = delete;
+
+  void run() {
+    // wakeups posted before the loop were ignored by embed. The timer drains
+    // anyway, should a wakeup get lost
+    m_running = true;
+    SetTimer(m_window, wakeup_timer, 100, nullptr);
+    drain_dispatch();
+    MSG msg;
+    BOOL res;
+    while ((res = GetMessage(&msg, nullptr, 0, 0)) != -1) {
+      // ilpropheta: the window might not be ours (and its procedure doesn't
+      // know about wakeups)
+      if (msg.hwnd == m_window &&
+          (msg.message == WM_APP ||
+           (msg.message == WM_TIMER && msg.wParam == wakeup_timer))) {
+        drain_dispatch();
+        continue;
+      }
+      if (msg.hwnd) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+        continue;
+      }
+      if (msg.message == WM_QUIT) {
+        return;
+      }
+    }
+  }
+  void *window() { return (void *)m_window; }
+  void terminate() { PostThreadMessage(m_main_thread, WM_QUIT, 0, 0); } // ilpropheta: changed in order to call terminate from another thread
+  // ilpropheta: lock-free, one WM_APP per batch instead of one per call
+  void dispatch(dispatch_fn_t f,
+                dispatch_lane lane = dispatch_lane::normal) {
+    if (m_dispatch_queue.push(std::move(f), lane)) {
+      post_wakeup();
+    }
+  }
+
+  void set_title(const std::string &title) {
+    SetWindowTextW(m_window, widen_string(title).c_str());
+  }
+
+  void set_size(int width, int height, int hints) {
+    auto style = GetWindowLong(m_window, GWL_STYLE);
+    if (hints == WEBVIEW_HINT_FIXED) {
+      style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
+    } else {
+      style |= (WS_THICKFRAME | WS_MAXIMIZEBOX);
+    }
+    SetWindowLong(m_window, GWL_STYLE, style);
+
+    if (hints == WEBVIEW_HINT_MAX) {
+      m_maxsz.x = width;
+      m_maxsz.y = height;
+    } else if (hints == WEBVIEW_HINT_MIN) {
+      m_minsz.x = width;
+      m_minsz.y = height;
+    } else {
+      RECT r;
+      r.left = r.top = 0;
+      r.right = width;
+      r.bottom = height;
+      AdjustWindowRect(&r, WS_OVERLAPPEDWINDOW, 0);
+      SetWindowPos(
+          m_window, NULL, r.left, r.top, r.right - r.left, r.bottom - r.top,
+          SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE | SWP_FRAMECHANGED);
+      resize(m_window);
+    }
+  }
+
+  void navigate(const std::string &url) {
+    auto wurl = widen_string(url);
+    m_webview->Navigate(wurl.c_str());
+  }
+
+  void init(const std::string &js) {
+    auto wjs = widen_string(js);
+    m_webview->AddScriptToExecuteOnDocumentCreated(wjs.c_str(), nullptr);
+  }
+
+  void eval(const std::string &js) {
+    auto wjs = widen_string(js);
+    m_webview->ExecuteScript(wjs.c_str(), nullptr);
   }
-  static cocoa_wkwebview_engine *get_associated_webview(id object) {
-    auto w =
-        (cocoa_wkwebview_engine *)objc_getAssociatedObject(object, "webview");
-    assert(w);
-    return w;
+
+  void set_html(const std::string &html) {
+    m_webview->NavigateToString(widen_string(html).c_str());
   }
-  static id get_main_bundle() noexcept {
-    return objc::msg_send<id>("NSBundle"_cls, "mainBundle"_sel);
+
+  // ilpropheta: the page gets json, already parsed, in the listener given to
+  // window.external.listen. It travels in a {"__bonnet": json} envelope: the
+  // message listener added by init, which runs before any page script, takes
+  // it out and stops it, so the page's own listeners never see it. json must
+  // be valid JSON. Returns false if it was not posted
+  bool post_web_message(const std::string &json) {
+    return SUCCEEDED(m_webview->PostWebMessageAsJson(
+        widen_string("{\"__bonnet\":" + json + "}").c_str()));
   }
-  static bool is_app_bundled() noexcept {
-    auto bundle = get_main_bundle();
-    if (!bundle) {
+
+  // ilpropheta: completes the binary call seq with the response body data
+  // (status 200), or with the JSON error data (status 500). Returns false if
+  // seq did not come through the binary transport
+  bool binary_reply(const std::string &seq, int status,
+                    std::span<const std::byte> data) {
+    auto it = m_binary_requests.find(seq);
+    if (it == m_binary_requests.end()) {
       return false;
     }
-    auto bundle_path = objc::msg_send<id>(bundle, "bundlePath"_sel);
-    auto bundled =
-        objc::msg_send<BOOL>(bundle_path, "hasSuffix:"_sel, ".app"_str);
-    return !!bundled;
+    const auto request = it->second;
+    m_binary_requests.erase(it);
+    complete(request, status, data);
+    return true;
   }
-  void on_application_did_finish_launching(id delegate, id app) {
-    // Stop the main run loop so that we can return
-    // from the constructor.
-    objc::msg_send<void>(app, "stop:"_sel, nullptr);
 
-    // Activate the app if it is not bundled.
-    // Bundled apps launched from Finder are activated automatically but
-    // otherwise not. Activating the app even when it has been launched from
-    // Finder does not seem to be harmful but calling this function is rarely
-    // needed as proper activation is normally taken care of for us.
-    // Bundled apps have a default activation policy of
-    // NSApplicationActivationPolicyRegular while non-bundled apps have a
-    // default activation policy of NSApplicationActivationPolicyProhibited.
-    if (!is_app_bundled()) {
-      // "setActivationPolicy:" must be invoked before
-      // "activateIgnoringOtherApps:" for activation to work.
-      objc::msg_send<void>(app, "setActivationPolicy:"_sel,
-                           NSApplicationActivationPolicyRegular);
-      // Activate the app regardless of other active apps.
-      // This can be obtrusive so we only do it when necessary.
-      objc::msg_send<void>(app, "activateIgnoringOtherApps:"_sel, YES);
+  // ilpropheta: fails the binary calls still waiting for binary_reply, those
+  // of a page that went away, so that their requests are not kept until the
+  // window closes
+  void cancel_binary_requests() {
+    constexpr std::string_view error = R"("the page went away")";
+    for (const auto &[seq, request] : std::exchange(m_binary_requests, {})) {
+      complete(request, 1, std::as_bytes(std::span(error)));
     }
+  }
 
-    // Main window
-    if (!m_parent_window) {
-      m_window = objc::msg_send<id>("NSWindow"_cls, "alloc"_sel);
-      auto style = NSWindowStyleMaskTitled;
-      m_window = objc::msg_send<id>(
-          m_window, "initWithContentRect:styleMask:backing:defer:"_sel,
-          CGRectMake(0, 0, 0, 0), style, NSBackingStoreBuffered, NO);
-    } else {
-      m_window = (id)m_parent_window;
-    }
+private:
+  struct binary_request {
+    ICoreWebView2WebResourceRequestedEventArgs *args;
+    ICoreWebView2Deferral *deferral;
+  };
 
-    // Webview
-    auto config = objc::msg_send<id>("WKWebViewConfiguration"_cls, "new"_sel);
-    m_manager = objc::msg_send<id>(config, "userContentController"_sel);
-    m_webview = objc::msg_send<id>("WKWebView"_cls, "alloc"_sel);
+  void complete(const binary_request &request, int status,
+                std::span<const std::byte> data) {
+    auto stream = SHCreateMemStream(reinterpret_cast<const BYTE *>(data.data()),
+                                    static_cast<UINT>(data.size()));
+    ICoreWebView2WebResourceResponse *response = nullptr;
+    if (stream) {
+      m_com_handler->environment()->CreateWebResourceResponse(
+          stream, status == 0 ? 200 : 500, status == 0 ? L"OK" : L"Error",
+          status == 0 ? L"Content-Type: application/octet-stream\r\n"
+                        L"Access-Control-Allow-Origin: *"
+                      : L"Content-Type: application/json\r\n"
+                        L"Access-Control-Allow-Origin: *",
+          &response);
+      stream->Release();
+    }
+    if (response) {
+      request.args->put_Response(response);
+      response->Release();
+    }
+    request.deferral->Complete();
+    request.deferral->Release();
+    request.args->Release();
+  }
 
-    if (m_debug) {
-      // Equivalent Obj-C:
-      // [[config preferences] setValue:@YES forKey:@"developerExtrasEnabled"];
-      objc::msg_send<id>(
-          objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-          objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-          "developerExtrasEnabled"_str);
+  // ilpropheta: a call of a binary binding, POSTed to binary_url + seq/name.
+  // The body is read straight from the request stream, and the response is
+  // deferred until binary_reply
+  void on_resource_requested(ICoreWebView2WebResourceRequestedEventArgs *args) {
+    ICoreWebView2WebResourceRequest *request = nullptr;
+    LPWSTR uri = nullptr;
+    if (FAILED(args->get_Request(&request))) {
+      return;
+    }
+    std::string path;
+    if (SUCCEEDED(request->get_Uri(&uri))) {
+      path = narrow_string(uri);
+      CoTaskMemFree(uri);
+    }
+    const auto prefix = narrow_string(binary_url);
+    const auto slash = path.find('/', prefix.size());
+    if (path.compare(0, prefix.size(), prefix) != 0 ||
+        slash == std::string::npos) {
+      request->Release();
+      return;
+    }
+    auto seq = path.substr(prefix.size(), slash - prefix.size());
+    auto name = percent_decode(std::string_view(path).substr(slash + 1));
+
+    std::vector<std::byte> body;
+    IStream *content = nullptr;
+    if (SUCCEEDED(request->get_Content(&content)) && content) {
+      STATSTG stat;
+      if (SUCCEEDED(content->Stat(&stat, STATFLAG_NONAME))) {
+        body.resize(static_cast<size_t>(stat.cbSize.QuadPart));
+      }
+      size_t size = 0;
+      ULONG read = 0;
+      do {
+        if (size == body.size()) {
+          // the size is unknown, or the stream is longer than it said
+          std::byte probe[4096];
+          if (FAILED(content->Read(probe, sizeof(probe), &read))) {
+            break;
+          }
+          body.insert(body.end(), probe, probe + read);
+        } else if (FAILED(content->Read(
+                       body.data() + size,
+                       static_cast<ULONG>(
+                           std::min<size_t>(body.size() - size, 0x7fffffff)),
+                       &read))) {
+          break;
+        }
+        size += read;
+      } while (read > 0);
+      body.resize(size);
+      content->Release();
     }
+    request->Release();
 
-    // Equivalent Obj-C:
-    // [[config preferences] setValue:@YES forKey:@"fullScreenEnabled"];
-    objc::msg_send<id>(
-        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-        "fullScreenEnabled"_str);
+    ICoreWebView2Deferral *deferral = nullptr;
+    if (FAILED(args->GetDeferral(&deferral))) {
+      return;
+    }
+    args->AddRef();
+    m_binary_requests[seq] = {args, deferral};
+    on_binary_message(seq, name, body);
+  }
 
-    // Equivalent Obj-C:
-    // [[config preferences] setValue:@YES forKey:@"javaScriptCanAccessClipboard"];
-    objc::msg_send<id>(
-        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-        "javaScriptCanAccessClipboard"_str);
+  bool embed(HWND wnd, bool debug, msg_cb_t cb) {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    flag.test_and_set();
 
-    // Equivalent Obj-C:
-    // [[config preferences] setValue:@YES forKey:@"DOMPasteAllowed"];
-    objc::msg_send<id>(
-        objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-        objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-        "DOMPasteAllowed"_str);
+    wchar_t currentExePath[MAX_PATH];
+    GetModuleFileNameW(NULL, currentExePath, MAX_PATH);
+    wchar_t *currentExeName = PathFindFileNameW(currentExePath);
 
-    auto ui_delegate = create_webkit_ui_delegate();
-    objc::msg_send<void>(m_webview, "initWithFrame:configuration:"_sel,
-                         CGRectMake(0, 0, 0, 0), config);
-    objc::msg_send<void>(m_webview, "setUIDelegate:"_sel, ui_delegate);
-    objc::msg_send<void>(m_manager, "addScriptMessageHandler:name:"_sel,
-                         delegate, "external"_str);
+    wchar_t dataPath[MAX_PATH];
+    if (!SUCCEEDED(SHGetFolderPathW(NULL, CSIDL_APPDATA, NULL, 0, dataPath))) {
+      return false;
+    }
+    wchar_t userDataFolder[MAX_PATH];
+    PathCombineW(userDataFolder, dataPath, currentExeName);
 
-    init(R"script(
-      window.external = {
-        invoke: function(s) {
-          window.webkit.messageHandlers.external.postMessage(s);
+    m_com_handler = new webview2_com_handler(
+        wnd, cb,
+        [this](ICoreWebView2WebResourceRequestedEventArgs *args) {
+          on_resource_requested(args);
         },
-      };
-      )script");
-    objc::msg_send<void>(m_window, "setContentView:"_sel, m_webview);
-    objc::msg_send<void>(m_window, "makeKeyAndOrderFront:"_sel, nullptr);
+        [&](ICoreWebView2Controller *controller, ICoreWebView2 *webview) {
+          controller->AddRef();
+          webview->AddRef();
+          m_controller = controller;
+          m_webview = webview;
+          flag.clear();
+        });
+    HRESULT res = CreateCoreWebView2EnvironmentWithOptions(
+        nullptr, userDataFolder, nullptr, m_com_handler);
+    if (res != S_OK) {
+      return false;
+    }
+    MSG msg = {};
+    while (flag.test_and_set() && GetMessage(&msg, NULL, 0, 0)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    }
+    ICoreWebView2Settings *settings = nullptr;
+    res = m_webview->get_Settings(&settings);
+    if (res != S_OK) {
+      return false;
+    }
+    res = settings->put_AreDevToolsEnabled(debug ? TRUE : FALSE);
+    if (res != S_OK) {
+      return false;
+    }
+    init("(function(){var w=window.chrome.webview,fs=[];"
+         "w.addEventListener('message',function(e){"
+         "if(e.data&&e.data.__bonnet!==undefined){"
+         "e.stopImmediatePropagation();"
+         "fs.forEach(function(f){f(e.data.__bonnet)})}});"
+         "window.external={invoke:s=>w.postMessage(s),"
+         "listen:f=>fs.push(f),binary:'" +
+         narrow_string(binary_url) + "'}})()");
+    return true;
   }
-  bool m_debug;
-  void *m_parent_window;
-  id m_window;
-  id m_webview;
-  id m_manager;
+
+  static constexpr UINT_PTR wakeup_timer = 1;
+
+  void post_wakeup() {
+    if (!PostMessage(m_window, WM_APP, 0, 0)) {
+      m_dispatch_queue.wakeup_lost(); // e.g. the message queue is full
+    }
+  }
+
+  // Nothing runs before the loop starts (embed runs a loop of its own)
+  void drain_dispatch() {
+    if (m_running && m_dispatch_queue.drain()) {
+      post_wakeup();
+    }
+  }
+
+  void resize(HWND wnd) {
+    if (m_controller == nullptr) {
+      return;
+    }
+    RECT bounds;
+    GetClientRect(wnd, &bounds);
+    m_controller->put_Bounds(bounds);
+  }
+
+  static bool is_webview2_available() noexcept {
+    LPWSTR version_info = nullptr;
+    auto res =
+        GetAvailableCoreWebView2BrowserVersionString(nullptr, &version_info);
+    // The result will be equal to HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)
+    // if the WebView2 runtime is not installed.
+    auto ok = SUCCEEDED(res) && version_info;
+    if (version_info) {
+      CoTaskMemFree(version_info);
+    }
+    return ok;
+  }
+
+  virtual void on_message(const std::string &msg) = 0;
+  virtual void on_binary_message(const std::string &seq,
+                                 const std::string &name,
+                                 std::span<const std::byte> data) = 0;
+
+  // The app is expected to call CoInitializeEx before
+  // CreateCoreWebView2EnvironmentWithOptions.
+  // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/webview2-idl#createcorewebview2environmentwithoptions
+  com_init_wrapper m_com_init{COINIT_APARTMENTTHREADED};
+  HWND m_window = NULL;
+  POINT m_minsz = POINT{0, 0};
+  POINT m_maxsz = POINT{0, 0};
+  DWORD m_main_thread = GetCurrentThreadId();
+  ICoreWebView2 *m_webview = nullptr;
+  ICoreWebView2Controller *m_controller = nullptr;
+  webview2_com_handler *m_com_handler = nullptr;
+  std::map<std::string, binary_request> m_binary_requests;
+  dispatch_queue m_dispatch_queue;
+  bool m_running = false;
 };
 
 } // namespace detail
 
-using browser_engine = detail::cocoa_wkwebview_engine;
+using browser_engine = detail::win32_edge_engine;
 
 } // namespace webview
 
-#elif defined(WEBVIEW_EDGE)
+#endif /* WEBVIEW_GTK, WEBVIEW_COCOA, WEBVIEW_HEADLESS, WEBVIEW_EDGE */
 
-//
-// ====================================================================
-//
-// This implementation uses Win32 API to create a native window. It
-// uses Edge/Chromium webview2 backend as a browser engine.
-//
-// ====================================================================
-//
+namespace webview {
 
-#define WIN32_LEAN_AND_MEAN
-#include <shlobj.h>
-#include <shlwapi.h>
-#include <stdlib.h>
-#include <windows.h>
+class webview : public browser_engine {
+public:
+  webview(bool debug = false, void *wnd = nullptr)
+      : browser_engine(debug, wnd) {}
 
-#include "WebView2.h"
+  ~webview() {
+    {
+      std::lock_guard lock{alive->mutex};
+      alive->w = nullptr;
+    }
+    // producers blocked on streams nobody will consume anymore give up
+    for (const auto &[seq, state] : streams) {
+      cancel_stream(*state);
+    }
+    // and so do the calls still running (stop callbacks might resolve them)
+    std::unordered_map<std::string, std::stop_source> calls;
+    {
+      std::lock_guard lock{tracked_mutex};
+      calls.swap(tracked_calls);
+    }
+    for (auto &[seq, stop] : calls) {
+      stop.request_stop();
+    }
+  }
+
+  // ilpropheta: the bindings (and the event bus) are there from the first page
+  void run() {
+    flush_defs();
+    browser_engine::run();
+  }
+
+  void navigate(const std::string &url) {
+    flush_defs();
+    if (url == "") {
+      browser_engine::navigate("about:blank");
+      return;
+    }
+    browser_engine::navigate(url);
+  }
+
+  void set_html(const std::string &html) {
+    flush_defs();
+    browser_engine::set_html(html);
+  }
+
+  using binding_t = std::function<void(std::string, std::string, void *)>;
+  class binding_ctx_t {
+  public:
+    binding_ctx_t(binding_t callback, void *arg)
+        : callback(std::move(callback)), arg(arg) {}
+    // This function is called upon execution of the bound JS function
+    binding_t callback;
+    // This user-supplied argument is passed to the callback
+    void *arg;
+    // ilpropheta: the callback tracks its calls itself (see
+    // cancellable_binding_t), calls of streams are never timed out and
+    // notifications have no seq and get no reply
+    bool cancellable = false;
+    bool stream = false;
+    bool notification = false;
+  };
+
+  using sync_binding_t = std::function<std::string(std::string)>;
+
+  // Synchronous bind
+  void bind(const std::string &name, sync_binding_t fn) {
+    bind(
+        name,
+        [this, fn = std::move(fn)](const std::string &seq,
+                                   const std::string &req,
+                                   void *) { resolve(seq, 0, fn(req)); },
+        nullptr);
+  }
 
-#ifdef _MSC_VER
-#pragma comment(lib, "ole32.lib")
-#pragma comment(lib, "shell32.lib")
-#pragma comment(lib, "shlwapi.lib")
-#pragma comment(lib, "user32.lib")
-#endif
+  // ilpropheta: where a synchronous binding runs. Off the window thread,
+  // results still go through resolve, and an exception rejects the call
+  // with its message
+  enum class execution {
+    ui,     // on the window thread
+    pool,   // on the shared worker pool
+    serial, // on the shared worker pool, one call at a time, in order
+  };
 
-namespace webview {
-namespace detail {
+  struct binding_options {
+    execution where = execution::ui;
+    // pool only: calls running at once, the others wait (0 is no limit)
+    size_t max_concurrency = 0;
+  };
 
-using msg_cb_t = std::function<void(const std::string)>;
+  void bind(const std::string &name, sync_binding_t fn,
+            binding_options options) {
+    if (options.where == execution::ui) {
+      bind(name, std::move(fn));
+      return;
+    }
+    auto limiter = std::make_shared<detail::concurrency_limiter>(
+        worker_pool(),
+        options.where == execution::serial ? 1 : options.max_concurrency);
+    auto shared_fn = std::make_shared<sync_binding_t>(std::move(fn));
+    bind(
+        name,
+        [this, limiter, shared_fn](const std::string &seq,
+                                   const std::string &req, void *) {
+          limiter->submit([this, shared_fn, seq, req]() {
+            if (stats_enabled.load(std::memory_order_relaxed)) {
+              stats_started(seq);
+            }
+            resolve_with(seq, [&] { return (*shared_fn)(req); });
+          });
+        },
+        nullptr);
+  }
 
-// Converts a narrow (UTF-8-encoded) string into a wide (UTF-16-encoded) string.
-inline std::wstring widen_string(const std::string &input) {
-  if (input.empty()) {
-    return std::wstring();
+  // Threads of the shared worker pool (by default, one less than the
+  // hardware threads), effective until the first pool binding is bound
+  void set_pool_size(size_t threads) { pool_size = threads; }
+
+  // ilpropheta: coroutine bindings return a task that completes the call
+  // through resolve: its JSON result resolves it, an exception rejects it with
+  // its message. The coroutine starts on the window thread and, while it waits
+  // on the awaitables below, it ties up no thread at all
+  using task_binding_t = std::function<task<std::string>(std::string)>;
+
+  void bind(const std::string &name, task_binding_t fn) {
+    auto shared_fn = std::make_shared<task_binding_t>(std::move(fn));
+    bind(
+        name,
+        [this, shared_fn](const std::string &seq, const std::string &req,
+                          void *) {
+          run_task(seq, [shared_fn, req]() mutable {
+            return (*shared_fn)(std::move(req));
+          });
+        },
+        nullptr);
   }
-  UINT cp = CP_UTF8;
-  DWORD flags = MB_ERR_INVALID_CHARS;
-  auto input_c = input.c_str();
-  auto input_length = static_cast<int>(input.size());
-  auto required_length =
-      MultiByteToWideChar(cp, flags, input_c, input_length, nullptr, 0);
-  if (required_length > 0) {
-    std::wstring output(static_cast<std::size_t>(required_length), L'\0');
-    if (MultiByteToWideChar(cp, flags, input_c, input_length, &output[0],
-                            required_length) > 0) {
-      return output;
+
+  // ilpropheta: typed binding of a function, e.g. bind<&add>("add") with
+  // int add(int, int). The params are decoded straight into the arguments
+  // (see json_traits) and the result is encoded back; a mismatch rejects the
+  // call with a JSON-RPC "invalid params" error. The function can return void
+  // (null), a value, or a task of a value to be a coroutine binding
+  template <auto Fn> void bind(const std::string &name) {
+    using signature = detail::fn_signature<decltype(Fn)>;
+    using result_t = typename signature::result;
+    if constexpr (detail::is_task<result_t>::value) {
+      bind(name, task_binding_t{&call_typed_task<Fn>});
+    } else {
+      bind(
+          name,
+          [this](const std::string &seq, const std::string &req, void *) {
+            std::string result;
+            const auto status = call_typed<Fn>(req, result);
+            resolve(seq, status, result);
+          },
+          nullptr);
     }
   }
-  // Failed to convert string from UTF-8 to UTF-16
-  return std::wstring();
-}
 
-// Converts a wide (UTF-16-encoded) string into a narrow (UTF-8-encoded) string.
-inline std::string narrow_string(const std::wstring &input) {
-  if (input.empty()) {
-    return std::string();
+  // ilpropheta: notification bindings, like JSON-RPC notifications, get no
+  // reply. The JS function returns nothing and posts the call without an id,
+  // nothing is kept on the page waiting for it, and the handler has nothing
+  // to give back: an exception only counts as an error in the statistics.
+  // Meant for telemetry and logging
+  using notification_binding_t = std::function<void(std::string req)>;
+
+  void bind_notification(const std::string &name, notification_binding_t fn) {
+    bind_notification(name, std::move(fn), binding_options{});
   }
-  UINT cp = CP_UTF8;
-  DWORD flags = WC_ERR_INVALID_CHARS;
-  auto input_c = input.c_str();
-  auto input_length = static_cast<int>(input.size());
-  auto required_length = WideCharToMultiByte(cp, flags, input_c, input_length,
-                                             nullptr, 0, nullptr, nullptr);
-  if (required_length > 0) {
-    std::string output(static_cast<std::size_t>(required_length), '\0');
-    if (WideCharToMultiByte(cp, flags, input_c, input_length, &output[0],
-                            required_length, nullptr, nullptr) > 0) {
-      return output;
+
+  void bind_notification(const std::string &name, notification_binding_t fn,
+                         binding_options options) {
+    auto shared_fn = std::make_shared<notification_binding_t>(std::move(fn));
+    std::shared_ptr<detail::concurrency_limiter> limiter;
+    if (options.where != execution::ui) {
+      limiter = std::make_shared<detail::concurrency_limiter>(
+          worker_pool(),
+          options.where == execution::serial ? 1 : options.max_concurrency);
     }
+    auto ctx = std::make_shared<binding_ctx_t>(
+        [this, name, limiter, shared_fn](const std::string &,
+                                         const std::string &req, void *) {
+          stats_clock::time_point received;
+          if (stats_enabled.load(std::memory_order_relaxed)) {
+            received = stats_clock::now();
+          }
+          if (!limiter) {
+            notify(name, *shared_fn, req, received);
+            return;
+          }
+          limiter->submit([this, name, shared_fn, req, received]() {
+            notify(name, *shared_fn, req, received);
+          });
+        },
+        nullptr);
+    ctx->notification = true;
+    add_binding(name, std::move(ctx), shim_kind::notification);
   }
-  // Failed to convert string from UTF-16 to UTF-8
-  return std::string();
-}
 
-// A wrapper around COM library initialization. Calls CoInitializeEx in the
-// constructor and CoUninitialize in the destructor.
-class com_init_wrapper {
-public:
-  com_init_wrapper(DWORD dwCoInit) {
-    // We can safely continue as long as COM was either successfully
-    // initialized or already initialized.
-    // RPC_E_CHANGED_MODE means that CoInitializeEx was already called with
-    // a different concurrency model.
-    switch (CoInitializeEx(nullptr, dwCoInit)) {
-    case S_OK:
-    case S_FALSE:
-      m_initialized = true;
-      break;
-    }
+  // ilpropheta: cancellation. The page gives up on a call when it aborts the
+  // AbortSignal passed as the last argument of the JS function (e.g.
+  // AbortSignal.timeout(ms)), when the call is pending for longer than the
+  // call timeout, or when the page goes away. Its promise is rejected right
+  // away and a late result is ignored, so nobody has to resolve a stopped
+  // call; these bindings get a std::stop_token to stop working on it, which
+  // is stopped on the window thread
+  using cancellable_binding_t = std::function<void(
+      std::string seq, std::string req, std::stop_token stop)>;
+  using cancellable_sync_binding_t =
+      std::function<std::string(std::string req, std::stop_token stop)>;
+  using cancellable_task_binding_t =
+      std::function<task<std::string>(std::string req, std::stop_token stop)>;
+
+  // Asynchronous bind, the user calls resolve
+  void bind(const std::string &name, cancellable_binding_t fn) {
+    auto ctx = std::make_shared<binding_ctx_t>(
+        [this, fn = std::move(fn)](const std::string &seq,
+                                   const std::string &req,
+                                   void *) { fn(seq, req, track_call(seq)); },
+        nullptr);
+    ctx->cancellable = true;
+    add_binding(name, std::move(ctx));
   }
 
-  ~com_init_wrapper() {
-    if (m_initialized) {
-      CoUninitialize();
-      m_initialized = false;
+  void bind(const std::string &name, cancellable_sync_binding_t fn) {
+    bind(name, std::move(fn), binding_options{});
+  }
+
+  // Off the window thread, calls stopped while they wait to run are dropped
+  void bind(const std::string &name, cancellable_sync_binding_t fn,
+            binding_options options) {
+    auto shared_fn =
+        std::make_shared<cancellable_sync_binding_t>(std::move(fn));
+    if (options.where == execution::ui) {
+      bind(name, cancellable_binding_t{[this, shared_fn](std::string seq,
+                                                         std::string req,
+                                                         std::stop_token stop) {
+             resolve_with(seq, [&] { return (*shared_fn)(req, stop); });
+           }});
+      return;
     }
+    auto limiter = std::make_shared<detail::concurrency_limiter>(
+        worker_pool(),
+        options.where == execution::serial ? 1 : options.max_concurrency);
+    bind(name, cancellable_binding_t{[this, limiter, shared_fn](
+                                         std::string seq, std::string req,
+                                         std::stop_token stop) {
+           limiter->submit([this, shared_fn, seq, req, stop]() {
+             if (stop.stop_requested()) {
+               return;
+             }
+             if (stats_enabled.load(std::memory_order_relaxed)) {
+               stats_started(seq);
+             }
+             resolve_with(seq, [&] { return (*shared_fn)(req, stop); });
+           });
+         }});
   }
 
-  com_init_wrapper(const com_init_wrapper &other) = delete;
-  com_init_wrapper &operator=(const com_init_wrapper &other) = delete;
-  com_init_wrapper(com_init_wrapper &&other) = delete;
-  com_init_wrapper &operator=(com_init_wrapper &&other) = delete;
+  void bind(const std::string &name, cancellable_task_binding_t fn) {
+    auto shared_fn =
+        std::make_shared<cancellable_task_binding_t>(std::move(fn));
+    bind(name, cancellable_binding_t{[this, shared_fn](std::string seq,
+                                                       std::string req,
+                                                       std::stop_token stop) {
+           run_task(seq, [shared_fn, req = std::move(req),
+                          stop = std::move(stop)]() mutable {
+             return (*shared_fn)(std::move(req), std::move(stop));
+           });
+         }});
+  }
 
-  bool is_initialized() const { return m_initialized; }
+  // Calls still pending after timeout (but those of streams) are rejected
+  // with detail::timeout_error and stopped. 0, the default, is no timeout
+  void set_call_timeout(std::chrono::milliseconds timeout) {
+    call_timeout.store(timeout, std::memory_order_relaxed);
+  }
 
 private:
-  bool m_initialized = false;
-};
+  // ilpropheta: how timers and completions, which can fire from other threads
+  // while the webview is destroyed or after, reach it: w is cleared first
+  // thing in the destructor, and from then on nothing is dispatched (the
+  // coroutines still waiting are not resumed)
+  struct liveness {
+    explicit liveness(webview *w) : w(w) {}
+    webview *w;
+    std::mutex mutex;
+
+    void dispatch(std::function<void()> f) {
+      std::lock_guard lock{mutex};
+      if (w) {
+        w->dispatch(std::move(f));
+      }
+    }
+  };
 
-// Holds a symbol name and associated type for code clarity.
-template <typename T> class library_symbol {
 public:
-  using type = T;
+  // Resumes the coroutine on the window thread once duration has elapsed
+  auto delay(std::chrono::steady_clock::duration duration) {
+    struct awaiter {
+      webview *w;
+      std::chrono::steady_clock::duration duration;
+      bool await_ready() const noexcept { return duration.count() <= 0; }
+      void await_suspend(std::coroutine_handle<> h) {
+        w->timer_thread().add(
+            std::chrono::steady_clock::now() + duration,
+            [alive = w->alive, h] { alive->dispatch([h] { h.resume(); }); });
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{this, duration};
+  }
 
-  constexpr explicit library_symbol(const char *name) : m_name(name) {}
-  constexpr const char *get_name() const { return m_name; }
+  // Resumes the coroutine on the shared worker pool, to run blocking code
+  auto resume_on_pool() {
+    struct awaiter {
+      webview *w;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        w->worker_pool().submit([h] { h.resume(); });
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{this};
+  }
+
+  // Resumes the coroutine on the window thread
+  auto resume_on_ui() {
+    struct awaiter {
+      webview *w;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        w->dispatch([h] { h.resume(); });
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{this};
+  }
+
+  // Bridge from callback-based I/O (process output, pipe writes, sockets) to
+  // coroutines: the callback calls set_value or set_exception, once and from
+  // any thread, and the coroutine awaiting the completion resumes on the
+  // window thread. Copies share the same state, and can outlive the webview
+  template <typename T> class completion {
+  public:
+    explicit completion(webview &w)
+        : m_state(std::make_shared<state>(w.alive)) {}
+
+    void set_value(T value) const {
+      settle([&](state &s) { s.value.emplace(std::move(value)); });
+    }
+    void set_exception(std::exception_ptr error) const {
+      settle([&](state &s) { s.error = std::move(error); });
+    }
+
+    auto operator co_await() const {
+      struct awaiter {
+        std::shared_ptr<state> s;
+        bool await_ready() const {
+          std::lock_guard lock{s->mutex};
+          return s->done;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+          std::lock_guard lock{s->mutex};
+          if (s->done) {
+            return false;
+          }
+          s->waiter = h;
+          return true;
+        }
+        T await_resume() {
+          if (s->error) {
+            std::rethrow_exception(s->error);
+          }
+          return std::move(*s->value);
+        }
+      };
+      return awaiter{m_state};
+    }
+
+  private:
+    struct state {
+      explicit state(std::shared_ptr<liveness> alive)
+          : alive(std::move(alive)) {}
+      std::shared_ptr<liveness> alive;
+      std::mutex mutex;
+      std::optional<T> value;
+      std::exception_ptr error;
+      std::coroutine_handle<> waiter;
+      bool done = false;
+    };
+
+    template <typename F> void settle(F &&set) const {
+      std::coroutine_handle<> waiter;
+      {
+        std::lock_guard lock{m_state->mutex};
+        if (m_state->done) {
+          return;
+        }
+        set(*m_state);
+        m_state->done = true;
+        waiter = m_state->waiter;
+      }
+      if (waiter) {
+        m_state->alive->dispatch([waiter] { waiter.resume(); });
+      }
+    }
+
+    std::shared_ptr<state> m_state;
+  };
 
 private:
-  const char *m_name;
-};
+  struct stream_state;
 
-// Loads a native shared library and allows one to get addresses for those
-// symbols.
-class native_library {
 public:
-  explicit native_library(const wchar_t *name) : m_handle(LoadLibraryW(name)) {}
-
-  ~native_library() {
-    if (m_handle) {
-      FreeLibrary(m_handle);
-      m_handle = nullptr;
+  // ilpropheta: streaming bindings emit any number of JSON chunks before they
+  // end. The JS function returns an async iterator (readable() turns it into
+  // a ReadableStream); chunks are flushed at most once per frame, those of all
+  // the streams in a single eval. The page acknowledges the chunks it consumes
+  // and a stream stays writable while less than detail::stream_window are
+  // pending, so the producer goes at the consumer's pace
+  class stream {
+  public:
+    // All of them can be called from any thread. Chunks written after the
+    // end, or after the consumer went away, are dropped
+    void write(std::string json) const {
+      auto &s = *m_owner->state;
+      const auto valid = detail::json_valid(json);
+      bool schedule;
+      {
+        std::lock_guard lock{s.mutex};
+        if (s.end || s.cancelled) {
+          return;
+        }
+        s.non_json |= !valid;
+        s.chunks.append(json).append(",");
+        s.bytes += json.size();
+        ++s.pending;
+        schedule = !std::exchange(s.dirty, true);
+      }
+      if (schedule) {
+        s.w.schedule_frame(m_owner->state);
+      }
+    }
+    void close() const { finish(m_owner->state, 1, {}); }
+    // Ends the stream with an error, the JSON value the iterator throws
+    void fail(std::string json) const {
+      finish(m_owner->state, 2, std::move(json));
     }
-  }
 
-  native_library(const native_library &other) = delete;
-  native_library &operator=(const native_library &other) = delete;
-  native_library(native_library &&other) = default;
-  native_library &operator=(native_library &&other) = default;
+    bool writable() const {
+      std::lock_guard lock{m_owner->state->mutex};
+      return m_owner->state->writable();
+    }
+    // The consumer stopped reading (or the page went away)
+    bool cancelled() const {
+      std::lock_guard lock{m_owner->state->mutex};
+      return m_owner->state->cancelled;
+    }
 
-  // Returns true if the library is currently loaded; otherwise false.
-  operator bool() const { return is_loaded(); }
+    // Resumes the coroutine on the window thread once the stream is writable
+    // (or it's over, check cancelled)
+    auto ready() const {
+      struct awaiter {
+        std::shared_ptr<stream_state> s;
+        bool await_ready() const {
+          std::lock_guard lock{s->mutex};
+          return s->writable() || s->end || s->cancelled;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+          std::lock_guard lock{s->mutex};
+          if (s->writable() || s->end || s->cancelled) {
+            return false;
+          }
+          s->waiters.push_back(h);
+          return true;
+        }
+        void await_resume() const noexcept {}
+      };
+      return awaiter{m_owner->state};
+    }
 
-  // Get the address for the specified symbol or nullptr if not found.
-  template <typename Symbol>
-  typename Symbol::type get(const Symbol &symbol) const {
-    if (is_loaded()) {
-      return reinterpret_cast<typename Symbol::type>(
-          GetProcAddress(m_handle, symbol.get_name()));
+    // Blocks until the stream is writable (or it's over). Not to be called on
+    // the window thread, which is the one receiving the acknowledgments
+    void wait_writable() const {
+      auto &s = *m_owner->state;
+      std::unique_lock lock{s.mutex};
+      s.space.wait(lock,
+                   [&s] { return s.writable() || s.end || s.cancelled; });
     }
-    return nullptr;
-  }
 
-  // Returns true if the library is currently loaded; otherwise false.
-  bool is_loaded() const { return !!m_handle; }
+  private:
+    friend class webview;
+
+    // Closes the stream when the last copy of the handle is gone
+    struct owner {
+      explicit owner(std::shared_ptr<stream_state> state)
+          : state(std::move(state)) {}
+      owner(const owner &) = delete;
+      owner &operator=(const owner &) = delete;
+      ~owner() { finish(state, 1, {}); }
+
+      const std::shared_ptr<stream_state> state;
+    };
+
+    explicit stream(std::shared_ptr<stream_state> state)
+        : m_owner(std::make_shared<owner>(std::move(state))) {}
+
+    static void finish(const std::shared_ptr<stream_state> &state, int end,
+                       std::string error) {
+      const auto valid = error.empty() || detail::json_valid(error);
+      bool schedule;
+      {
+        std::lock_guard lock{state->mutex};
+        if (state->end || state->cancelled) {
+          return;
+        }
+        state->non_json |= !valid;
+        state->end = end;
+        state->error = std::move(error);
+        schedule = !std::exchange(state->dirty, true);
+      }
+      if (schedule) {
+        state->w.schedule_frame(state);
+      }
+    }
 
-private:
-  HMODULE m_handle = nullptr;
-};
+    std::shared_ptr<owner> m_owner;
+  };
 
-struct user32_symbols {
-  using DPI_AWARENESS_CONTEXT = HANDLE;
-  using SetProcessDpiAwarenessContext_t = BOOL(WINAPI *)(DPI_AWARENESS_CONTEXT);
+  using stream_binding_t = std::function<void(std::string req, stream s)>;
+
+  // The binding starts on the window thread and can hand the stream over to
+  // any other; an exception escaping it fails the stream
+  void bind_stream(const std::string &name, stream_binding_t fn) {
+    auto shared_fn = std::make_shared<stream_binding_t>(std::move(fn));
+    auto ctx = std::make_shared<binding_ctx_t>(
+        [this, shared_fn](const std::string &seq, const std::string &req,
+                          void *) { start_stream(seq, *shared_fn, req); },
+        nullptr);
+    ctx->stream = true;
+    if (binary_bindings.contains(name) ||
+        !bindings.insert(name, std::move(ctx))) {
+      return;
+    }
+    define_js(name, shim_kind::stream);
+  }
 
-  static constexpr auto SetProcessDpiAwarenessContext =
-      library_symbol<SetProcessDpiAwarenessContext_t>(
-          "SetProcessDpiAwarenessContext");
-  static constexpr auto SetProcessDPIAware =
-      library_symbol<decltype(&::SetProcessDPIAware)>("SetProcessDPIAware");
-};
+  // ilpropheta: event bus from native code to the page. The page subscribes
+  // with window.external.subscribe(topic, callback), which returns the
+  // function that unsubscribes, and native code publishes JSON values from
+  // any thread. Values of a topic nobody subscribed to are dropped right away;
+  // the others are delivered at most once per frame, all the topics by a
+  // single eval, either the latest value of the frame or all of them in an
+  // array, depending on the topic mode
+  enum class topic_mode { latest, batch };
+
+  void set_topic_mode(const std::string &topic, topic_mode mode) {
+    {
+      std::lock_guard lock{topic_modes_mutex};
+      topic_modes[topic] = mode;
+    }
+    if (const auto t = topics.find(topic)) {
+      std::lock_guard lock{t->mutex};
+      if (t->mode != mode) {
+        t->mode = mode;
+        t->values.clear();
+      }
+    }
+  }
 
-struct shcore_symbols {
-  typedef enum { PROCESS_PER_MONITOR_DPI_AWARE = 2 } PROCESS_DPI_AWARENESS;
-  using SetProcessDpiAwareness_t = HRESULT(WINAPI *)(PROCESS_DPI_AWARENESS);
+  // Whether the page is subscribed to topic, to skip building its values
+  bool subscribed(std::string_view topic) const {
+    return topics.contains(topic);
+  }
 
-  static constexpr auto SetProcessDpiAwareness =
-      library_symbol<SetProcessDpiAwareness_t>("SetProcessDpiAwareness");
-};
+  void publish(std::string_view topic, std::string json) {
+    auto t = topics.find(topic);
+    if (!t) {
+      return;
+    }
+    const auto valid = detail::json_valid(json);
+    bool schedule;
+    {
+      std::lock_guard lock{t->mutex};
+      t->non_json |= !valid;
+      if (t->mode == topic_mode::latest) {
+        t->values = std::move(json);
+      } else {
+        t->values.append(json).append(",");
+      }
+      schedule = !std::exchange(t->dirty, true);
+    }
+    if (schedule) {
+      schedule_frame(std::move(t));
+    }
+  }
 
-inline bool enable_dpi_awareness() {
-  auto user32 = native_library(L"user32.dll");
-  if (auto fn = user32.get(user32_symbols::SetProcessDpiAwarenessContext)) {
-    if (fn(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE)) {
-      return true;
+  // ilpropheta: DOM events dispatched on window (json_detail becomes
+  // event.detail), from any thread. They are delivered in order with the
+  // frame flush; while the window thread is busy at most max_pending_events
+  // wait, the oldest ones are dropped
+  static constexpr size_t max_pending_events = 10000;
+
+  void dispatch_event(std::string type, std::string json_detail) {
+    const auto valid = detail::json_valid(json_detail);
+    std::unique_lock lock{frame_mutex};
+    if (pending_events.size() == max_pending_events) {
+      pending_events.pop_front();
+      ++dropped_events;
     }
-    return GetLastError() == ERROR_ACCESS_DENIED;
+    pending_events.push_back({std::move(type), std::move(json_detail), valid});
+    request_frame(lock);
   }
-  if (auto shcore = native_library(L"shcore.dll")) {
-    if (auto fn = shcore.get(shcore_symbols::SetProcessDpiAwareness)) {
-      auto result = fn(shcore_symbols::PROCESS_PER_MONITOR_DPI_AWARE);
-      return result == S_OK || result == E_ACCESSDENIED;
+
+  // Events dropped so far
+  size_t dropped_dom_events() {
+    std::lock_guard lock{frame_mutex};
+    return dropped_events;
+  }
+
+  // ilpropheta: per-binding statistics of the calls: counts, errors, bytes of
+  // requests and responses, and latency histograms of the time calls wait to
+  // run (queue) and of the time they take to complete (exec). When disabled,
+  // the default, they cost a single check per call
+  void enable_stats(bool enable) {
+    stats_enabled.store(enable, std::memory_order_relaxed);
+    if (!enable) {
+      for (auto &shard : timings) {
+        std::lock_guard lock{shard.mutex};
+        shard.calls.clear();
+      }
     }
   }
-  if (auto fn = user32.get(user32_symbols::SetProcessDPIAware)) {
-    return !!fn();
+
+  // {"name":{"calls":..,"errors":..,"bytes_in":..,"bytes_out":..,
+  //  "queue_us":{"p50":..,"p90":..,"p99":..,"max":..},"exec_us":{..}},..}
+  std::string stats_json() const {
+    std::string out = "{";
+    stats.for_each([this, &out](std::string_view name,
+                                const detail::binding_stats &binding) {
+      const auto s = binding.take();
+      detail::json_escape(name, out);
+      out += ":{\"calls\":" + std::to_string(s.calls) +
+             ",\"errors\":" + std::to_string(s.errors) +
+             ",\"bytes_in\":" + std::to_string(s.bytes_in) +
+             ",\"bytes_out\":" + std::to_string(s.bytes_out) +
+             ",\"queue_us\":";
+      detail::append_percentiles(s.queue, out);
+      out += ",\"exec_us\":";
+      detail::append_percentiles(s.exec, out);
+      if (const auto cache = caches.find(name)) {
+        const auto c = cache->results.take();
+        char ratio[16] = "0";
+        if (c.hits + c.misses) {
+          *std::to_chars(ratio, ratio + sizeof(ratio) - 1,
+                         double(c.hits) / double(c.hits + c.misses),
+                         std::chars_format::fixed, 3)
+               .ptr = '\0';
+        }
+        out += ",\"cache\":{\"hits\":" + std::to_string(c.hits) +
+               ",\"misses\":" + std::to_string(c.misses) +
+               ",\"hit_ratio\":" + ratio +
+               ",\"entries\":" + std::to_string(c.entries) +
+               ",\"bytes\":" + std::to_string(c.bytes) + "}";
+      }
+      out += "},";
+    });
+    if (out.back() == ',') {
+      out.back() = '}';
+    } else {
+      out += '}';
+    }
+    return out;
   }
-  return true;
-}
 
-class webview2_com_handler
-    : public ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler,
-      public ICoreWebView2CreateCoreWebView2ControllerCompletedHandler,
-      public ICoreWebView2WebMessageReceivedEventHandler,
-      public ICoreWebView2PermissionRequestedEventHandler {
-  using webview2_com_handler_cb_t =
-      std::function<void(ICoreWebView2Controller *, ICoreWebView2 *webview)>;
+  // ilpropheta: memoization of idempotent bindings (lookups of translations,
+  // configuration, ...). Successful results are kept by canonical params
+  // (see detail::json_canonical), and a call found in the cache is resolved
+  // right away without running the binding. Streams, notifications and
+  // binary bindings are never cached. With mirror, the page keeps a copy of
+  // the results (same time to live and budget) so that its hits don't cross
+  // the bridge at all; those hits are not in the statistics
+  struct cache_options {
+    // results older than this are called again (0: they never expire)
+    std::chrono::milliseconds ttl{0};
+    // keys and results beyond this size are dropped, least recently used
+    // first
+    size_t max_bytes = 1 << 20;
+    bool mirror = false;
+  };
 
-public:
-  webview2_com_handler(HWND hwnd, msg_cb_t msgCb, webview2_com_handler_cb_t cb)
-      : m_window(hwnd), m_msgCb(msgCb), m_cb(cb) {}
+  // Replaces the cache of name, if any (it can be set before the binding)
+  void cache(const std::string &name, cache_options options) {
+    caches.erase(name);
+    caches.insert(name, std::make_shared<binding_cache>(options));
+    caching.store(true, std::memory_order_relaxed);
+    if (const auto ctx = bindings.find(name);
+        ctx && !ctx->stream && !ctx->notification) {
+      define_js(name, shim_kind::call);
+    }
+  }
 
-  virtual ~webview2_com_handler() = default;
-  webview2_com_handler(const webview2_com_handler &other) = delete;
-  webview2_com_handler &operator=(const webview2_com_handler &other) = delete;
-  webview2_com_handler(webview2_com_handler &&other) = delete;
-  webview2_com_handler &operator=(webview2_com_handler &&other) = delete;
+  // Drops the cached results of name, also in the page. From any thread
+  void invalidate(const std::string &name) {
+    if (const auto cache = caches.find(name)) {
+      cache->results.invalidate();
+      if (cache->options.mirror) {
+        forget_in_page(detail::json_escape(name), true);
+      }
+    }
+  }
 
-  ULONG STDMETHODCALLTYPE AddRef() { return ++m_ref_count; }
-  ULONG STDMETHODCALLTYPE Release() {
-    if (m_ref_count > 1) {
-      return --m_ref_count;
+  // Only those of params, the JSON array of the arguments
+  void invalidate(const std::string &name, const std::string &params) {
+    if (const auto cache = caches.find(name)) {
+      cache->results.invalidate(detail::json_canonical(params));
+      if (cache->options.mirror) {
+        forget_in_page(detail::json_escape(name) + "," + params,
+                       detail::json_valid(params));
+      }
     }
-    delete this;
-    return 0;
   }
-  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, LPVOID *ppv) {
-    if (!ppv) {
-      return E_POINTER;
+
+  // Asynchronous bind, the user calls resolve
+  void bind(const std::string &name, binding_t f, void *arg) {
+    add_binding(name, std::make_shared<binding_ctx_t>(std::move(f), arg));
+  }
+
+  // ilpropheta: binary bindings take an ArrayBuffer, a typed array or a
+  // DataView, and resolve to an ArrayBuffer. The bytes cross without any text
+  // encoding when the engine has a binary transport; otherwise they travel
+  // base64 encoded, in chunks of detail::binary_chunk_size bytes
+  using binary_binding_t = std::function<void(
+      const std::string &seq, std::span<const std::byte> data, void *arg)>;
+  using sync_binary_binding_t =
+      std::function<std::vector<std::byte>(std::span<const std::byte>)>;
+
+  // Asynchronous binary bind, the result is given to resolve_binary
+  void bind_binary(const std::string &name, binary_binding_t fn, void *arg) {
+    if (!bindings.contains(name) &&
+        binary_bindings.insert(name, std::make_shared<binary_binding_ctx_t>(
+                                         binary_binding_ctx_t{std::move(fn),
+                                                              arg}))) {
+      define_js(name, shim_kind::binary);
     }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
   }
-  HRESULT STDMETHODCALLTYPE Invoke(HRESULT res, ICoreWebView2Environment *env) {
-    env->CreateCoreWebView2Controller(m_window, this);
-    return S_OK;
+
+  // Synchronous binary bind
+  void bind_binary(const std::string &name, sync_binary_binding_t fn) {
+    bind_binary(
+        name,
+        [this, fn = std::move(fn)](const std::string &seq,
+                                   std::span<const std::byte> data, void *) {
+          const auto result = fn(data);
+          resolve_binary(seq, 0, result);
+        },
+        nullptr);
   }
-  HRESULT STDMETHODCALLTYPE Invoke(HRESULT res,
-                                   ICoreWebView2Controller *controller) {
-    ICoreWebView2 *webview;
-    ::EventRegistrationToken token;
-    controller->get_CoreWebView2(&webview);
-    webview->add_WebMessageReceived(this, &token);
-    webview->add_PermissionRequested(this, &token);
 
-    m_cb(controller, webview);
-    return S_OK;
+  // If status is not 0, data is the JSON value the call is rejected with
+  void resolve_binary(const std::string &seq, int status,
+                      std::span<const std::byte> data) {
+    dispatch([seq, status, result = std::vector<std::byte>(data.begin(),
+                                                            data.end()),
+              this]() {
+      if (browser_engine::binary_reply(seq, status, result)) {
+        return;
+      }
+      std::string js = "window._rpc[" + seq + "]";
+      if (status == 0) {
+        js += ".resolve(Uint8Array.from(atob(\"";
+        detail::base64_encode(result, js);
+        js += "\"),function(c){return c.charCodeAt(0)}).buffer)";
+      } else {
+        js += ".reject(";
+        js.append(reinterpret_cast<const char *>(result.data()), result.size());
+        js += ")";
+      }
+      eval(js + "; delete window._rpc[" + seq + "]");
+    });
   }
-  HRESULT STDMETHODCALLTYPE Invoke(
-      ICoreWebView2 *sender, ICoreWebView2WebMessageReceivedEventArgs *args) {
-    LPWSTR message;
-    args->TryGetWebMessageAsString(&message);
-    m_msgCb(narrow_string(message));
-    sender->PostWebMessageAsString(message);
 
-    CoTaskMemFree(message);
-    return S_OK;
+  void unbind(const std::string &name) {
+    if (bindings.erase(name) || binary_bindings.erase(name)) {
+      define_js(name, shim_kind::unbound);
+    }
   }
-  HRESULT STDMETHODCALLTYPE Invoke(
-      ICoreWebView2 *sender, ICoreWebView2PermissionRequestedEventArgs *args) {
-    COREWEBVIEW2_PERMISSION_KIND kind;
-    args->get_PermissionKind(&kind);
-    if (kind == COREWEBVIEW2_PERMISSION_KIND_CLIPBOARD_READ) {
-      args->put_State(COREWEBVIEW2_PERMISSION_STATE_ALLOW);
+
+  // ilpropheta: called on the window thread whenever the JS side of bindings
+  // is injected, with the number of bindings defined (or removed), the size
+  // of the script and the time init and eval took
+  using shim_listener_t = std::function<void(
+      size_t bindings, size_t bytes, std::chrono::microseconds elapsed)>;
+
+  void set_shim_listener(shim_listener_t listener) {
+    shim_listener = std::move(listener);
+  }
+
+  // ilpropheta: completions are coalesced, all those received before the
+  // window thread gets to them are settled by a single eval
+  void resolve(const std::string &seq, int status, const std::string &result) {
+    if (tracked_count.load(std::memory_order_relaxed)) {
+      untrack_call(seq);
+    }
+    if (stats_enabled.load(std::memory_order_relaxed)) {
+      stats_completed(seq, status != 0, result.size());
+    }
+    if (cache_miss_count.load(std::memory_order_relaxed)) {
+      cache_result(seq, status, result);
+    }
+    // checked here, on the thread of the binding, so that results can be
+    // posted without parsing them again
+    const auto valid = result.empty() || detail::json_valid(result);
+    std::lock_guard lock{results_mutex};
+    auto &pending = valid ? pending_results : pending_script_results;
+    pending.append("[").append(seq).append(status == 0 ? ",0" : ",1");
+    if (!result.empty()) {
+      pending.append(",").append(result);
+    }
+    pending.append("],");
+    if (!std::exchange(results_scheduled, true)) {
+      dispatch([this]() { settle_results(); }, detail::dispatch_lane::high);
     }
-    return S_OK;
   }
 
 private:
-  HWND m_window;
-  msg_cb_t m_msgCb;
-  webview2_com_handler_cb_t m_cb;
-  std::atomic<ULONG> m_ref_count{1};
-};
+  // ilpropheta: the JS side of all the bindings is a single runtime,
+  // injected by one init together with the first table of bindings. Later
+  // binds and unbinds are queued and flushed as changes of the table, all
+  // those of a batch by one init and one eval
+  enum class shim_kind { unbound = -1, call, stream, binary, notification };
+
+  void define_js(const std::string &name, shim_kind kind) {
+    pending_defs.insert_or_assign(name, kind);
+    if (!std::exchange(defs_scheduled, true)) {
+      dispatch([this] { flush_defs(); });
+    }
+  }
 
-class win32_edge_engine {
-public:
-  win32_edge_engine(bool debug, void *window) {
-    if (!is_webview2_available()) {
+  // Also called before the page can need the bindings: before run and
+  // navigating
+  void flush_defs() {
+    defs_scheduled = false;
+    if (shim_injected && pending_defs.empty()) {
       return;
     }
-    if (!m_com_init.is_initialized()) {
-      return;
+    std::string js = shim_injected ? "" : shim_js() + ";";
+    js += "window._rpc.define({";
+    for (const auto &[name, kind] : pending_defs) {
+      detail::json_escape(name, js);
+      js += ':';
+      const auto cache =
+          kind == shim_kind::call ? caches.find(name) : nullptr;
+      if (cache && cache->options.mirror) {
+        js += '[' + std::to_string(cache->options.ttl.count()) + ',' +
+              std::to_string(cache->options.max_bytes) + "],";
+      } else {
+        js += std::to_string(static_cast<int>(kind)) + ',';
+      }
     }
-    enable_dpi_awareness();
-    if (window == nullptr) {
-      HINSTANCE hInstance = GetModuleHandle(nullptr);
-      HICON icon = (HICON)LoadImage(
-          hInstance, IDI_APPLICATION, IMAGE_ICON, GetSystemMetrics(SM_CXICON),
-          GetSystemMetrics(SM_CYICON), LR_DEFAULTCOLOR);
+    if (js.back() == ',') {
+      js.pop_back();
+    }
+    js += "})";
+    const auto start = std::chrono::steady_clock::now();
+    init(js);
+    eval(js);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    if (shim_listener) {
+      shim_listener(pending_defs.size(), js.size(), elapsed);
+    }
+    pending_defs.clear();
+    shim_injected = true;
+  }
 
-      WNDCLASSEXW wc;
-      ZeroMemory(&wc, sizeof(WNDCLASSEX));
-      wc.cbSize = sizeof(WNDCLASSEX);
-      wc.hInstance = hInstance;
-      wc.lpszClassName = L"webview";
-      wc.hIcon = icon;
-      wc.lpfnWndProc =
-          (WNDPROC)(+[](HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) -> LRESULT {
-            auto w = (win32_edge_engine *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
-            switch (msg) {
-            case WM_SIZE:
-              w->resize(hwnd);
-              break;
-            case WM_CLOSE:
-              DestroyWindow(hwnd);
-              break;
-            case WM_DESTROY:
-              w->terminate();
-              break;
-            case WM_GETMINMAXINFO: {
-              auto lpmmi = (LPMINMAXINFO)lp;
-              if (w == nullptr) {
-                return 0;
+  // RPC: calls made within the same microtask are posted together, as an
+  // array, and RPC.settle receives completions in batches. Every page starts
+  // numbering calls at random, so that late results for a page that went away
+  // can't settle calls of the next one.
+  // Bus: the first subscriber of a topic subscribes the page to it, the last
+  // one unsubscribes it. A new page starts with no subscriptions.
+  // Streams: a stream is fed [chunks, end, error], end is 1 when it's closed
+  // and 2 when it failed. Consumed chunks are acknowledged in batches, and
+  // return() (or cancel() of the ReadableStream) tells the producer to stop.
+  // Binary: the binary transport is used if the engine has one, otherwise the
+  // bytes are posted in base64 chunks to detail::binary_chunk_method
+  // Cache: a call whose cache is mirrored is defined as [ttl, max_bytes]
+  // instead of its kind, and the page keeps its results by canonical params
+  // (sizes are in characters). RPC.forget drops them, all or those of some
+  // params, and results of calls started before are not kept
+  static std::string shim_js() {
+    return std::string("(function() { var cancel = '") +
+           detail::cancel_method + "', subscribe = '" +
+           detail::subscribe_method + "', ack = '" +
+           detail::stream_ack_method +
+           "', every = " + std::to_string(detail::stream_window / 4) +
+           ", chunk = " + std::to_string(detail::binary_chunk_size) +
+           ", upload = '" + detail::binary_chunk_method + "';" + R"(
+      var RPC = window._rpc = (window._rpc ||
+          {nextSeq: Math.floor(Math.random() * 0x100000) * 0x100000000 + 1});
+      if (RPC.define) {
+        return;
+      }
+      RPC.queue = [];
+      RPC.post = function(call) {
+        if (RPC.queue.push(call) === 1) {
+          Promise.resolve().then(function() {
+            var calls = RPC.queue;
+            RPC.queue = [];
+            window.external.invoke(
+                JSON.stringify(calls.length === 1 ? calls[0] : calls));
+          });
+        }
+      };
+      RPC.call = function(method, args) {
+        var params = Array.prototype.slice.call(args);
+        var signal = params[params.length - 1];
+        if (typeof AbortSignal !== 'undefined' &&
+            signal instanceof AbortSignal) {
+          params.pop();
+          if (signal.aborted) {
+            return Promise.reject(signal.reason);
+          }
+        } else {
+          signal = null;
+        }
+        var seq = RPC.nextSeq++;
+        var promise = new Promise(function(resolve, reject) {
+          var call = RPC[seq] = {resolve: resolve, reject: reject};
+          if (signal) {
+            var abort = function() {
+              delete RPC[seq];
+              RPC.post({id: seq, method: cancel, params: []});
+              reject(signal.reason);
+            };
+            signal.addEventListener('abort', abort);
+            call.done = function() {
+              signal.removeEventListener('abort', abort);
+            };
+          }
+        });
+        RPC.post({id: seq, method: method, params: params});
+        return promise;
+      };
+      RPC.settle = function(results) {
+        results.forEach(function(r) {
+          var call = RPC[r[0]];
+          if (call) {
+            delete RPC[r[0]];
+            if (call.done) {
+              call.done();
+            }
+            (r[1] === 0 ? call.resolve : call.reject)(r[2]);
+          }
+        });
+      };
+      RPC.topics = {};
+      RPC.deliver = function(events) {
+        events.forEach(function(e) {
+          (RPC.topics[e[0]] || []).slice().forEach(function(callback) {
+            callback(e[1]);
+          });
+        });
+      };
+      RPC.events = function(events) {
+        events.forEach(function(e) {
+          window.dispatchEvent(new CustomEvent(e[0], {detail: e[1]}));
+        });
+      };
+      RPC.feed = function(frames) {
+        frames.forEach(function(f) {
+          var call = RPC[f[0]];
+          if (call) {
+            call.feed(f[1], f[2], f[3]);
+          }
+        });
+      };
+      RPC.receive = function(message) {
+        ['settle', 'feed', 'deliver', 'events', 'forget'].forEach(function(k) {
+          if (message[k]) {
+            RPC[k](message[k]);
+          }
+        });
+      };
+      if (window.external.listen) {
+        window.external.listen(RPC.receive);
+      }
+      RPC.post({id: 0, method: subscribe, params: []});
+      window.external.subscribe = function(topic, callback) {
+        var callbacks = RPC.topics[topic] = RPC.topics[topic] || [];
+        if (callbacks.push(callback) === 1) {
+          RPC.post({id: 0, method: subscribe, params: [topic, true]});
+        }
+        return function() {
+          var i = callbacks.indexOf(callback);
+          if (i >= 0) {
+            callbacks.splice(i, 1);
+            if (!callbacks.length) {
+              delete RPC.topics[topic];
+              RPC.post({id: 0, method: subscribe, params: [topic, false]});
+            }
+          }
+        };
+      };
+      function stream(name) {
+        return function() {
+          var seq = RPC.nextSeq++;
+          var chunks = [], head = 0, end = 0, error, unacked = 0, reader = null;
+          function acknowledge(cancelled) {
+            RPC.post({id: seq, method: ack, params: [unacked, cancelled]});
+            unacked = 0;
+          }
+          function next() {
+            if (head < chunks.length) {
+              var value = chunks[head++];
+              if (head === chunks.length) {
+                chunks = [];
+                head = 0;
               }
-              if (w->m_maxsz.x > 0 && w->m_maxsz.y > 0) {
-                lpmmi->ptMaxSize = w->m_maxsz;
-                lpmmi->ptMaxTrackSize = w->m_maxsz;
+              if (!end && (++unacked >= every || !chunks.length)) {
+                acknowledge(false);
               }
-              if (w->m_minsz.x > 0 && w->m_minsz.y > 0) {
-                lpmmi->ptMinTrackSize = w->m_minsz;
+              return Promise.resolve({value: value, done: false});
+            }
+            if (end === 1) {
+              return Promise.resolve({value: undefined, done: true});
+            }
+            if (end === 2) {
+              return Promise.reject(error);
+            }
+            return new Promise(function(resolve, reject) {
+              reader = {resolve: resolve, reject: reject};
+            });
+          }
+          function feed(values, e, err) {
+            Array.prototype.push.apply(chunks, values);
+            if (e) {
+              end = e;
+              error = err;
+              delete RPC[seq];
+            }
+            if (reader && (head < chunks.length || end)) {
+              var r = reader;
+              reader = null;
+              next().then(r.resolve, r.reject);
+            }
+          }
+          RPC[seq] = {
+            feed: feed,
+            resolve: function(v) { feed(v === undefined ? [] : [v], 1); },
+            reject: function(e) { feed([], 2, e); },
+          };
+          var stream = {
+            next: next,
+            return: function() {
+              if (!end) {
+                end = 1;
+                chunks = [];
+                head = 0;
+                delete RPC[seq];
+                acknowledge(true);
               }
-            } break;
-            default:
-              return DefWindowProcW(hwnd, msg, wp, lp);
+              return Promise.resolve({value: undefined, done: true});
+            },
+            readable: function() {
+              return new ReadableStream({
+                pull: function(controller) {
+                  return next().then(function(r) {
+                    r.done ? controller.close() : controller.enqueue(r.value);
+                  });
+                },
+                cancel: function() { stream.return(); },
+              });
+            },
+          };
+          stream[Symbol.asyncIterator] = function() { return stream; };
+          RPC.post({
+            id: seq,
+            method: name,
+            params: Array.prototype.slice.call(arguments),
+          });
+          return stream;
+        };
+      }
+      function binary(name) {
+        return function(data) {
+          var bytes = data instanceof ArrayBuffer ? new Uint8Array(data) :
+              new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+          var seq = RPC.nextSeq++;
+          if (window.external.binary) {
+            return fetch(window.external.binary + seq + '/' +
+                encodeURIComponent(name), {method: 'POST', body: bytes})
+              .then(function(r) {
+                return r.ok ? r.arrayBuffer() :
+                    r.json().then(function(e) { throw e; });
+              });
+          }
+          var promise = new Promise(function(resolve, reject) {
+            RPC[seq] = {
+              resolve: resolve,
+              reject: reject,
+            };
+          });
+          for (var i = 0; i === 0 || i < bytes.length; i += chunk) {
+            var part = bytes.subarray(i, i + chunk), s = '';
+            for (var j = 0; j < part.length; j += 0x8000) {
+              s += String.fromCharCode.apply(
+                  null, part.subarray(j, j + 0x8000));
             }
-            return 0;
+            window.external.invoke(JSON.stringify({
+              id: seq,
+              method: upload,
+              params: [name, i + chunk >= bytes.length, btoa(s)],
+            }));
+          }
+          return promise;
+        };
+      }
+      function canonical(v) {
+        if (v && typeof v.toJSON === 'function') {
+          v = v.toJSON();
+        }
+        if (Array.isArray(v)) {
+          return '[' + v.map(canonical).join(',') + ']';
+        }
+        if (v && typeof v === 'object') {
+          return '{' + Object.keys(v).sort().map(function(k) {
+            return JSON.stringify(k) + ':' + canonical(v[k]);
+          }).join(',') + '}';
+        }
+        return JSON.stringify(v);
+      }
+      RPC.caches = {};
+      function cached(name, ttl, budget) {
+        var cache = RPC.caches[name] = {entries: new Map(), bytes: 0, age: 0};
+        cache.drop = function(key) {
+          var e = cache.entries.get(key);
+          if (e) {
+            cache.entries.delete(key);
+            cache.bytes -= e.size;
+          }
+        };
+        return function() {
+          var params = Array.prototype.slice.call(arguments);
+          if (typeof AbortSignal !== 'undefined' &&
+              params[params.length - 1] instanceof AbortSignal) {
+            params.pop();
+          }
+          var key = canonical(params);
+          var e = cache.entries.get(key);
+          if (e && (!ttl || e.expires > Date.now())) {
+            cache.entries.delete(key);
+            cache.entries.set(key, e);
+            return Promise.resolve(JSON.parse(e.json));
+          }
+          cache.drop(key);
+          var age = cache.age;
+          return RPC.call(name, arguments).then(function(value) {
+            var json = JSON.stringify(value);
+            if (json !== undefined && age === cache.age &&
+                key.length + json.length <= budget) {
+              cache.drop(key);
+              cache.entries.set(key, {
+                json: json,
+                size: key.length + json.length,
+                expires: Date.now() + ttl,
+              });
+              cache.bytes += key.length + json.length;
+              for (var k of cache.entries.keys()) {
+                if (cache.bytes <= budget) {
+                  break;
+                }
+                cache.drop(k);
+              }
+            }
+            return value;
           });
-      RegisterClassExW(&wc);
-      m_window = CreateWindowW(L"webview", L"", WS_OVERLAPPEDWINDOW,
-                               CW_USEDEFAULT, CW_USEDEFAULT, 640, 480, nullptr,
-                               nullptr, hInstance, nullptr);
-      if (m_window == nullptr) {
-        return;
+        };
       }
-      SetWindowLongPtr(m_window, GWLP_USERDATA, (LONG_PTR)this);
-    } else {
-      m_window = *(static_cast<HWND *>(window));
+      RPC.forget = function(entries) {
+        entries.forEach(function(f) {
+          var cache = RPC.caches[f[0]];
+          if (cache) {
+            cache.age++;
+            if (f.length > 1) {
+              cache.drop(canonical(f[1]));
+            } else {
+              cache.entries.clear();
+              cache.bytes = 0;
+            }
+          }
+        });
+      };
+      var kinds = [function(name) {
+        return function() {
+          return RPC.call(name, arguments);
+        };
+      }, stream, binary, function(name) {
+        return function() {
+          RPC.post({
+            method: name,
+            params: Array.prototype.slice.call(arguments),
+          });
+        };
+      }];
+      RPC.define = function(table) {
+        for (var name in table) {
+          delete RPC.caches[name];
+          if (Array.isArray(table[name])) {
+            window[name] = cached(name, table[name][0], table[name][1]);
+          } else if (table[name] < 0) {
+            delete window[name];
+          } else {
+            window[name] = kinds[table[name]](name);
+          }
+        }
+      };
+    })())";
+  }
+
+  void settle_results() {
+    std::string results;
+    std::string script_results;
+    {
+      std::lock_guard lock{results_mutex};
+      results.swap(pending_results);
+      script_results.swap(pending_script_results);
+      results_scheduled = false;
+    }
+    if (!results.empty()) {
+      results.back() = ']';
+      send_to_page("{\"settle\":[" + results + "}", true);
+    }
+    if (!script_results.empty()) {
+      script_results.back() = ']';
+      send_to_page("{\"settle\":[" + script_results + "}", false);
     }
+  }
 
-    ShowWindow(m_window, SW_SHOW);
-    UpdateWindow(m_window);
-    SetFocus(m_window);
+  // ilpropheta: results, stream chunks, bus values and DOM events reach the
+  // page as a single JSON object, {"settle": [...], "feed": [...],
+  // "deliver": [...], "events": [...]},
+  // given to RPC.receive. It's posted as a web message, parsed by the browser
+  // without compiling any script, and evaluated only if it's not json or the
+  // engine can't post it. Whether it's JSON is known without parsing it: the
+  // message is built here, and the values it carries (results, chunks, ...)
+  // are checked as they come in, on the threads producing them. Values that
+  // are JS but not JSON, e.g. undefined, still work
+  void send_to_page(const std::string &message, bool json) {
+    if (!json || !browser_engine::post_web_message(message)) {
+      eval("window._rpc.receive(" + message + ")");
+    }
+  }
 
-    auto cb =
-        std::bind(&win32_edge_engine::on_message, this, std::placeholders::_1);
+  void on_binary_message(const std::string &seq, const std::string &name,
+                         std::span<const std::byte> data) {
+    const auto ctx = binary_bindings.find(name);
+    if (!ctx) {
+      constexpr std::string_view error = R"("unknown binary binding")";
+      resolve_binary(seq, 1, std::as_bytes(std::span(error)));
+      return;
+    }
+    ctx->callback(seq, data, ctx->arg);
+  }
 
-    embed(m_window, debug, cb);
-    resize(m_window);
-    m_controller->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+  // A chunk of a call of a binary binding: params are the binding name, a
+  // flag set on the last chunk and the base64 bytes
+  void on_binary_chunk(const std::string &seq, std::string_view params) {
+    detail::json_document doc;
+    std::string name;
+    bool last = false;
+    std::string_view data;
+    if (!doc.parse(params) || !doc.root()[0].get(name) ||
+        !doc.root()[1].get(last) || !doc.root()[2].get(data)) {
+      binary_uploads.erase(seq);
+      return;
+    }
+    auto &upload = binary_uploads[seq];
+    // once a call is rejected, the chunks left of it are dropped
+    if (!upload.rejected &&
+        data.size() / 4 * 3 > detail::max_binary_upload - upload.bytes.size()) {
+      upload.rejected = true;
+      upload.bytes = {};
+      constexpr std::string_view error = R"("binary upload too large")";
+      resolve_binary(seq, 1, std::as_bytes(std::span(error)));
+    }
+    if (!upload.rejected && !detail::base64_decode(data, upload.bytes)) {
+      binary_uploads.erase(seq);
+      return;
+    }
+    if (last) {
+      const auto rejected = upload.rejected;
+      const auto bytes = std::move(upload.bytes);
+      binary_uploads.erase(seq);
+      if (!rejected) {
+        on_binary_message(seq, name, bytes);
+      }
+    }
   }
 
-  virtual ~win32_edge_engine() {
-    if (m_com_handler) {
-      m_com_handler->Release();
-      m_com_handler = nullptr;
+  // ilpropheta: a message carries either a call or an array of calls
+  void on_message(const std::string &msg) {
+    const auto start = msg.find_first_not_of(" \t\n\r");
+    if (start == std::string::npos || msg[start] != '[') {
+      on_call(msg);
+      return;
     }
-    if (m_webview) {
-      m_webview->Release();
-      m_webview = nullptr;
+    detail::json_document calls;
+    if (!calls.parse(msg)) {
+      return;
+    }
+    const auto root = calls.root();
+    for (size_t i = 0; i < root.size(); ++i) {
+      on_call(root[i].raw());
+    }
+  }
+
+  void on_call(std::string_view msg) {
+    // ilpropheta: decoded in a single pass, method names with escapes are rare
+    detail::rpc_message rpc;
+    if (!detail::rpc_decode(msg, rpc)) {
+      return;
+    }
+    std::string_view name;
+    std::string unescaped;
+    if (!detail::json_unquote(rpc.method, name)) {
+      if (!detail::json_unescape(rpc.method, unescaped)) {
+        return;
+      }
+      name = unescaped;
+    }
+    if (name == detail::binary_chunk_method) {
+      on_binary_chunk(std::string(rpc.id), rpc.params);
+      return;
+    }
+    if (name == detail::stream_ack_method) {
+      on_stream_ack(std::string(rpc.id), rpc.params);
+      return;
+    }
+    if (name == detail::subscribe_method) {
+      on_subscribe(rpc.params);
+      return;
+    }
+    if (name == detail::cancel_method) {
+      stop_call(std::string(rpc.id));
+      return;
+    }
+    if (const auto ctx = bindings.find(name)) {
+      if (ctx->notification) {
+        ctx->callback({}, std::string(rpc.params), ctx->arg);
+        return;
+      }
+      if (rpc.id.empty()) {
+        return; // a notification of a function that wants to reply
+      }
+      if (stats_enabled.load(std::memory_order_relaxed)) {
+        stats_called(name, rpc.id, rpc.params.size());
+      }
+      std::string seq(rpc.id);
+      if (caching.load(std::memory_order_relaxed) && !ctx->stream) {
+        if (const auto cache = caches.find(name)) {
+          auto key = detail::json_canonical(rpc.params);
+          std::string result;
+          if (cache->results.find(key, result)) {
+            resolve(seq, 0, result);
+            return;
+          }
+          std::lock_guard lock{cache_mutex};
+          cache_misses.insert_or_assign(
+              seq,
+              cache_miss{cache, std::move(key), cache->results.generation()});
+          cache_miss_count.store(cache_misses.size(),
+                                 std::memory_order_relaxed);
+        }
+      }
+      if (!ctx->cancellable && !ctx->stream &&
+          call_timeout.load(std::memory_order_relaxed).count()) {
+        track_call(seq);
+      }
+      ctx->callback(seq, std::string(rpc.params), ctx->arg);
+    }
+  }
+
+  void add_binding(const std::string &name, std::shared_ptr<binding_ctx_t> ctx,
+                   shim_kind kind = shim_kind::call) {
+    if (!binary_bindings.contains(name) &&
+        bindings.insert(name, std::move(ctx))) {
+      define_js(name, kind);
+    }
+  }
+
+  // Resolves seq with the result of f, an exception rejects it
+  template <typename F> void resolve_with(const std::string &seq, F f) {
+    try {
+      resolve(seq, 0, f());
+    } catch (const rejection &r) {
+      resolve(seq, 1, r.json());
+    } catch (const std::exception &e) {
+      resolve(seq, 1, detail::json_escape(e.what()));
+    } catch (...) {
+      resolve(seq, 1, "\"unknown error\"");
+    }
+  }
+
+  // Starts the timeout of the call, if any, and returns its stop token
+  std::stop_token track_call(const std::string &seq) {
+    std::stop_source stop;
+    {
+      std::lock_guard lock{tracked_mutex};
+      tracked_calls.insert_or_assign(seq, stop);
+      tracked_count.store(tracked_calls.size(), std::memory_order_relaxed);
     }
-    if (m_controller) {
-      m_controller->Release();
-      m_controller = nullptr;
+    if (const auto timeout = call_timeout.load(std::memory_order_relaxed);
+        timeout.count()) {
+      timer_thread().add(std::chrono::steady_clock::now() + timeout,
+                         [this, seq] {
+                           dispatch([this, seq] {
+                             if (stop_call(seq)) {
+                               resolve(seq, 1, detail::timeout_error);
+                             }
+                           });
+                         });
     }
+    return stop.get_token();
   }
 
-  win32_edge_engine(const win32_edge_engine &other) = delete;
-  win32_edge_engine &operator=(const win32_edge_engine &other) = delete;
-  win32_edge_engine(win32_edge_engine &&other) = delete;
-  win32_edge_engine &operator=(win32_edge_engine &&other) = delete;
+  // The call is over, it can't be stopped anymore
+  void untrack_call(const std::string &seq) {
+    std::lock_guard lock{tracked_mutex};
+    if (tracked_calls.erase(seq)) {
+      tracked_count.store(tracked_calls.size(), std::memory_order_relaxed);
+    }
+  }
 
-  void run() {
-    MSG msg;
-    BOOL res;
-    while ((res = GetMessage(&msg, nullptr, 0, 0)) != -1) {
-      if (msg.hwnd) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-        continue;
+  // Returns false if the call is over (or unknown). A stopped call counts as
+  // an error in the statistics
+  bool stop_call(const std::string &seq) {
+    std::stop_source stop;
+    {
+      std::lock_guard lock{tracked_mutex};
+      const auto it = tracked_calls.find(seq);
+      if (it == tracked_calls.end()) {
+        return false;
       }
-      if (msg.message == WM_APP) {
-        auto f = (dispatch_fn_t *)(msg.lParam);
-        (*f)();
-        delete f;
-      } else if (msg.message == WM_QUIT) {
+      stop = std::move(it->second);
+      tracked_calls.erase(it);
+      tracked_count.store(tracked_calls.size(), std::memory_order_relaxed);
+    }
+    if (stats_enabled.load(std::memory_order_relaxed)) {
+      stats_completed(seq, true, 0);
+    }
+    if (cache_miss_count.load(std::memory_order_relaxed)) {
+      cache_result(seq, 1, {});
+    }
+    stop.request_stop();
+    return true;
+  }
+
+  // Stores the result of a call that missed the cache, if it succeeded
+  void cache_result(const std::string &seq, int status,
+                    const std::string &result) {
+    cache_miss miss;
+    {
+      std::lock_guard lock{cache_mutex};
+      const auto it = cache_misses.find(seq);
+      if (it == cache_misses.end()) {
         return;
       }
+      miss = std::move(it->second);
+      cache_misses.erase(it);
+      cache_miss_count.store(cache_misses.size(), std::memory_order_relaxed);
+    }
+    if (status == 0 && !result.empty()) {
+      miss.cache->results.store(std::move(miss.key), result, miss.generation);
     }
   }
-  void *window() { return (void *)m_window; }
-  void terminate() { PostThreadMessage(m_main_thread, WM_QUIT, 0, 0); } // ilpropheta: changed in order to call terminate from another thread
-  void dispatch(dispatch_fn_t f) {
-    PostThreadMessage(m_main_thread, WM_APP, 0, (LPARAM) new dispatch_fn_t(f));
+
+  // entry is the text of the arguments of RPC.forget, json if it's JSON
+  void forget_in_page(std::string entry, bool json) {
+    dispatch([this, entry = std::move(entry), json] {
+      send_to_page("{\"forget\":[[" + entry + "]]}", json);
+    });
   }
 
-  void set_title(const std::string &title) {
-    SetWindowTextW(m_window, widen_string(title).c_str());
+  // A new page (or the same one, reloaded) starts: whatever the previous page
+  // was waiting for is stopped, and left out of the statistics
+  void on_new_page() {
+    topics.clear();
+    binary_uploads.clear();
+    browser_engine::cancel_binary_requests();
+    for (const auto &[seq, state] : streams) {
+      cancel_stream(*state);
+    }
+    streams.clear();
+    std::unordered_map<std::string, std::stop_source> calls;
+    {
+      std::lock_guard lock{tracked_mutex};
+      calls.swap(tracked_calls);
+      tracked_count.store(0, std::memory_order_relaxed);
+    }
+    for (auto &[seq, stop] : calls) {
+      stop.request_stop();
+    }
+    {
+      std::lock_guard lock{cache_mutex};
+      cache_misses.clear();
+      cache_miss_count.store(0, std::memory_order_relaxed);
+    }
+    for (auto &shard : timings) {
+      std::lock_guard lock{shard.mutex};
+      shard.calls.clear();
+    }
   }
 
-  void set_size(int width, int height, int hints) {
-    auto style = GetWindowLong(m_window, GWL_STYLE);
-    if (hints == WEBVIEW_HINT_FIXED) {
-      style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
-    } else {
-      style |= (WS_THICKFRAME | WS_MAXIMIZEBOX);
+  detail::binding_registry<binding_ctx_t> bindings;
+
+  // changes of the binding table not injected yet, used on the window thread
+  std::map<std::string, shim_kind> pending_defs;
+  bool defs_scheduled = false;
+  bool shim_injected = false;
+  shim_listener_t shim_listener;
+
+  struct binary_binding_ctx_t {
+    binary_binding_t callback;
+    void *arg;
+  };
+  detail::binding_registry<binary_binding_ctx_t> binary_bindings;
+  // calls of binary bindings received in chunks, by seq
+  struct binary_upload {
+    std::vector<std::byte> bytes;
+    bool rejected = false; // over detail::max_binary_upload
+  };
+  std::map<std::string, binary_upload> binary_uploads;
+
+  std::mutex results_mutex;
+  std::string pending_results; // "[seq,status,result]," for each completion
+  std::string pending_script_results; // same, results that are not JSON
+  bool results_scheduled = false;
+
+  struct stream_state {
+    stream_state(webview &w, std::string seq) : w(w), seq(std::move(seq)) {}
+    bool writable() const {
+      return !end && !cancelled && pending < detail::stream_window;
     }
-    SetWindowLong(m_window, GWL_STYLE, style);
 
-    if (hints == WEBVIEW_HINT_MAX) {
-      m_maxsz.x = width;
-      m_maxsz.y = height;
-    } else if (hints == WEBVIEW_HINT_MIN) {
-      m_minsz.x = width;
-      m_minsz.y = height;
-    } else {
-      RECT r;
-      r.left = r.top = 0;
-      r.right = width;
-      r.bottom = height;
-      AdjustWindowRect(&r, WS_OVERLAPPEDWINDOW, 0);
-      SetWindowPos(
-          m_window, NULL, r.left, r.top, r.right - r.left, r.bottom - r.top,
-          SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE | SWP_FRAMECHANGED);
-      resize(m_window);
+    webview &w;
+    const std::string seq;
+    std::mutex mutex;
+    std::condition_variable space;
+    std::string chunks; // "chunk," for each chunk not flushed yet
+    size_t pending = 0; // chunks written and not consumed yet
+    size_t bytes = 0;   // of all the chunks written
+    int end = 0;        // 1 closed, 2 failed
+    std::string error;
+    bool cancelled = false;
+    bool dirty = false;    // waiting for a flush
+    bool non_json = false; // some chunk (or the error) waiting isn't JSON
+    std::vector<std::coroutine_handle<>> waiters; // of ready()
+  };
+
+  struct topic_state {
+    topic_state(const std::string &name, topic_mode mode)
+        : quoted_name(detail::json_escape(name)), mode(mode) {}
+
+    const std::string quoted_name;
+    std::mutex mutex;
+    topic_mode mode;
+    std::string values; // latest: the last value, batch: "value," for each
+    bool dirty = false;    // waiting for a flush
+    bool non_json = false; // some value waiting isn't JSON
+  };
+
+  void start_stream(const std::string &seq, const stream_binding_t &fn,
+                    const std::string &req) {
+    auto state = std::make_shared<stream_state>(*this, seq);
+    streams.emplace(seq, state);
+    // kept here so that an exception fails the stream before it's closed
+    const stream s{state};
+    try {
+      fn(req, s);
+    } catch (const rejection &r) {
+      stream::finish(state, 2, r.json());
+    } catch (const std::exception &e) {
+      stream::finish(state, 2, detail::json_escape(e.what()));
+    } catch (...) {
+      stream::finish(state, 2, "\"unknown error\"");
     }
   }
 
-  void navigate(const std::string &url) {
-    auto wurl = widen_string(url);
-    m_webview->Navigate(wurl.c_str());
+  // The first dirty stream or topic schedules a flush, one frame after the
+  // last one
+  template <typename State> void schedule_frame(std::shared_ptr<State> state) {
+    std::unique_lock lock{frame_mutex};
+    if constexpr (std::is_same_v<State, stream_state>) {
+      dirty_streams.push_back(std::move(state));
+    } else {
+      dirty_topics.push_back(std::move(state));
+    }
+    request_frame(lock);
   }
 
-  void init(const std::string &js) {
-    auto wjs = widen_string(js);
-    m_webview->AddScriptToExecuteOnDocumentCreated(wjs.c_str(), nullptr);
+  // Called holding frame_mutex, which is released
+  void request_frame(std::unique_lock<std::mutex> &lock) {
+    if (std::exchange(frame_scheduled, true)) {
+      return;
+    }
+    const auto when = frame_flushed + detail::frame_interval;
+    lock.unlock();
+    if (when <= std::chrono::steady_clock::now()) {
+      dispatch([this] { flush_frame(); });
+    } else {
+      timer_thread().add(when, [this] { dispatch([this] { flush_frame(); }); });
+    }
   }
 
-  void eval(const std::string &js) {
-    auto wjs = widen_string(js);
-    m_webview->ExecuteScript(wjs.c_str(), nullptr);
+  void flush_frame() {
+    std::vector<std::shared_ptr<stream_state>> streams_to_flush;
+    std::vector<std::shared_ptr<topic_state>> topics_to_flush;
+    std::deque<dom_event> events_to_flush;
+    {
+      std::lock_guard lock{frame_mutex};
+      streams_to_flush.swap(dirty_streams);
+      topics_to_flush.swap(dirty_topics);
+      events_to_flush.swap(pending_events);
+      frame_scheduled = false;
+      frame_flushed = std::chrono::steady_clock::now();
+    }
+    std::string message;
+    auto json = true;
+    flush_streams(streams_to_flush, message, json);
+    flush_topics(topics_to_flush, message, json);
+    if (!events_to_flush.empty()) {
+      message += ",\"events\":[";
+      for (const auto &e : events_to_flush) {
+        json = json && e.json;
+        message += '[';
+        detail::json_escape(e.type, message);
+        message.append(",").append(e.detail).append("],");
+      }
+      message.back() = ']';
+    }
+    if (!message.empty()) {
+      message.front() = '{';
+      send_to_page(message + "}", json);
+    }
   }
 
-  void set_html(const std::string &html) {
-    m_webview->NavigateToString(widen_string(html).c_str());
+  // Appends ,"feed":[...] with the chunks of dirty to the message
+  void flush_streams(const std::vector<std::shared_ptr<stream_state>> &dirty,
+                     std::string &out, bool &json) {
+    std::string js = ",\"feed\":[";
+    for (const auto &s : dirty) {
+      std::lock_guard lock{s->mutex};
+      s->dirty = false;
+      json = !std::exchange(s->non_json, false) && json;
+      if (s->cancelled) {
+        continue;
+      }
+      js.append("[").append(s->seq).append(",[");
+      if (s->chunks.empty()) {
+        js += ']';
+      } else {
+        s->chunks.back() = ']';
+        js += s->chunks;
+        s->chunks.clear();
+      }
+      if (s->end) {
+        js += s->end == 1 ? ",1" : ",2";
+        if (s->end == 2 && !s->error.empty()) {
+          js += "," + s->error;
+        }
+        if (stats_enabled.load(std::memory_order_relaxed)) {
+          stats_completed(s->seq, s->end == 2, s->bytes);
+        }
+        streams.erase(s->seq);
+      }
+      js += "],";
+    }
+    if (js.back() == ',') {
+      js.back() = ']';
+      out += js;
+    }
   }
 
-private:
-  bool embed(HWND wnd, bool debug, msg_cb_t cb) {
-    std::atomic_flag flag = ATOMIC_FLAG_INIT;
-    flag.test_and_set();
-
-    wchar_t currentExePath[MAX_PATH];
-    GetModuleFileNameW(NULL, currentExePath, MAX_PATH);
-    wchar_t *currentExeName = PathFindFileNameW(currentExePath);
-
-    wchar_t dataPath[MAX_PATH];
-    if (!SUCCEEDED(SHGetFolderPathW(NULL, CSIDL_APPDATA, NULL, 0, dataPath))) {
-      return false;
+  // Appends ,"deliver":[...] with the values of dirty to the message
+  void flush_topics(const std::vector<std::shared_ptr<topic_state>> &dirty,
+                    std::string &out, bool &json) {
+    std::string js = ",\"deliver\":[";
+    for (const auto &t : dirty) {
+      std::lock_guard lock{t->mutex};
+      t->dirty = false;
+      json = !std::exchange(t->non_json, false) && json;
+      if (t->values.empty()) {
+        continue;
+      }
+      js.append("[").append(t->quoted_name).append(",");
+      if (t->mode == topic_mode::latest) {
+        js += t->values;
+      } else {
+        t->values.back() = ']';
+        js.append("[").append(t->values);
+      }
+      t->values.clear();
+      js += "],";
     }
-    wchar_t userDataFolder[MAX_PATH];
-    PathCombineW(userDataFolder, dataPath, currentExeName);
+    if (js.back() == ',') {
+      js.back() = ']';
+      out += js;
+    }
+  }
 
-    m_com_handler = new webview2_com_handler(
-        wnd, cb,
-        [&](ICoreWebView2Controller *controller, ICoreWebView2 *webview) {
-          controller->AddRef();
-          webview->AddRef();
-          m_controller = controller;
-          m_webview = webview;
-          flag.clear();
-        });
-    HRESULT res = CreateCoreWebView2EnvironmentWithOptions(
-        nullptr, userDataFolder, nullptr, m_com_handler);
-    if (res != S_OK) {
-      return false;
+  // params are a topic and whether the page is subscribed to it, or nothing
+  // when a new page starts
+  void on_subscribe(std::string_view params) {
+    detail::json_document doc;
+    std::string topic;
+    bool subscribe = false;
+    if (!doc.parse(params)) {
+      return;
     }
-    MSG msg = {};
-    while (flag.test_and_set() && GetMessage(&msg, NULL, 0, 0)) {
-      TranslateMessage(&msg);
-      DispatchMessage(&msg);
+    if (doc.root().size() == 0) {
+      on_new_page();
+      return;
     }
-    ICoreWebView2Settings *settings = nullptr;
-    res = m_webview->get_Settings(&settings);
-    if (res != S_OK) {
-      return false;
+    if (!doc.root()[0].get(topic) || !doc.root()[1].get(subscribe)) {
+      return;
     }
-    res = settings->put_AreDevToolsEnabled(debug ? TRUE : FALSE);
-    if (res != S_OK) {
-      return false;
+    if (!subscribe) {
+      topics.erase(topic);
+      return;
     }
-    init("window.external={invoke:s=>window.chrome.webview.postMessage(s)}");
-    return true;
+    auto mode = topic_mode::latest;
+    {
+      std::lock_guard lock{topic_modes_mutex};
+      if (const auto it = topic_modes.find(topic); it != topic_modes.end()) {
+        mode = it->second;
+      }
+    }
+    topics.insert(topic, std::make_shared<topic_state>(topic, mode));
   }
 
-  void resize(HWND wnd) {
-    if (m_controller == nullptr) {
+  // params are the number of chunks consumed and whether the consumer left
+  void on_stream_ack(const std::string &seq, std::string_view params) {
+    const auto it = streams.find(seq);
+    detail::json_document doc;
+    size_t consumed = 0;
+    bool cancel = false;
+    if (it == streams.end() || !doc.parse(params) ||
+        !doc.root()[0].get(consumed) || !doc.root()[1].get(cancel)) {
       return;
     }
-    RECT bounds;
-    GetClientRect(wnd, &bounds);
-    m_controller->put_Bounds(bounds);
+    const auto state = it->second;
+    if (cancel) {
+      streams.erase(it);
+      cancel_stream(*state);
+      if (stats_enabled.load(std::memory_order_relaxed)) {
+        std::lock_guard lock{state->mutex};
+        stats_completed(seq, false, state->bytes);
+      }
+      return;
+    }
+    std::vector<std::coroutine_handle<>> waiters;
+    {
+      std::lock_guard lock{state->mutex};
+      state->pending -= std::min(consumed, state->pending);
+      if (!state->writable()) {
+        return;
+      }
+      waiters.swap(state->waiters);
+    }
+    state->space.notify_all();
+    for (const auto h : waiters) {
+      dispatch([h] { h.resume(); });
+    }
   }
 
-  static bool is_webview2_available() noexcept {
-    LPWSTR version_info = nullptr;
-    auto res =
-        GetAvailableCoreWebView2BrowserVersionString(nullptr, &version_info);
-    // The result will be equal to HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)
-    // if the WebView2 runtime is not installed.
-    auto ok = SUCCEEDED(res) && version_info;
-    if (version_info) {
-      CoTaskMemFree(version_info);
+  void cancel_stream(stream_state &s) {
+    std::vector<std::coroutine_handle<>> waiters;
+    {
+      std::lock_guard lock{s.mutex};
+      s.cancelled = true;
+      s.chunks.clear();
+      waiters.swap(s.waiters);
+    }
+    s.space.notify_all();
+    for (const auto h : waiters) {
+      dispatch([h] { h.resume(); });
     }
-    return ok;
   }
 
-  virtual void on_message(const std::string &msg) = 0;
+  // open streams by seq, used on the window thread only
+  std::map<std::string, std::shared_ptr<stream_state>> streams;
+
+  // topics the page is subscribed to
+  detail::binding_registry<topic_state> topics;
+  std::mutex topic_modes_mutex;
+  std::map<std::string, topic_mode, std::less<>> topic_modes;
+
+  std::mutex frame_mutex;
+  std::vector<std::shared_ptr<stream_state>> dirty_streams;
+  std::vector<std::shared_ptr<topic_state>> dirty_topics;
+  struct dom_event {
+    std::string type;
+    std::string detail;
+    bool json; // detail is valid JSON
+  };
+  std::deque<dom_event> pending_events;
+  size_t dropped_events = 0;
+  bool frame_scheduled = false;
+  std::chrono::steady_clock::time_point frame_flushed;
 
-  // The app is expected to call CoInitializeEx before
-  // CreateCoreWebView2EnvironmentWithOptions.
-  // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/webview2-idl#createcorewebview2environmentwithoptions
-  com_init_wrapper m_com_init{COINIT_APARTMENTTHREADED};
-  HWND m_window = NULL;
-  POINT m_minsz = POINT{0, 0};
-  POINT m_maxsz = POINT{0, 0};
-  DWORD m_main_thread = GetCurrentThreadId();
-  ICoreWebView2 *m_webview = nullptr;
-  ICoreWebView2Controller *m_controller = nullptr;
-  webview2_com_handler *m_com_handler = nullptr;
-};
+  using stats_clock = std::chrono::steady_clock;
 
-} // namespace detail
+  struct call_timing {
+    std::shared_ptr<detail::binding_stats> stats;
+    stats_clock::time_point received;
+    stats_clock::time_point started;
+  };
 
-using browser_engine = detail::win32_edge_engine;
+  // Calls being timed, sharded by seq
+  struct alignas(64) timing_shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, call_timing> calls;
+  };
 
-} // namespace webview
+  timing_shard &timings_of(std::string_view seq) {
+    return timings[std::hash<std::string_view>{}(seq) % timings.size()];
+  }
 
-#endif /* WEBVIEW_GTK, WEBVIEW_COCOA, WEBVIEW_EDGE */
+  std::shared_ptr<detail::binding_stats> stats_of(std::string_view name) {
+    auto binding = stats.find(name);
+    if (!binding) {
+      stats.insert(name, std::make_shared<detail::binding_stats>());
+      binding = stats.find(name);
+    }
+    return binding;
+  }
 
-namespace webview {
+  void stats_called(std::string_view name, std::string_view seq,
+                    size_t bytes) {
+    auto binding = stats_of(name);
+    binding->called(bytes);
+    const auto now = stats_clock::now();
+    auto &shard = timings_of(seq);
+    std::lock_guard lock{shard.mutex};
+    shard.calls.insert_or_assign(std::string(seq),
+                                 call_timing{std::move(binding), now, now});
+  }
 
-class webview : public browser_engine {
-public:
-  webview(bool debug = false, void *wnd = nullptr)
-      : browser_engine(debug, wnd) {}
+  // The call waited until now to run
+  void stats_started(const std::string &seq) {
+    auto &shard = timings_of(seq);
+    std::lock_guard lock{shard.mutex};
+    if (const auto it = shard.calls.find(seq); it != shard.calls.end()) {
+      it->second.started = stats_clock::now();
+    }
+  }
 
-  void navigate(const std::string &url) {
-    if (url == "") {
-      browser_engine::navigate("about:blank");
-      return;
+  void stats_completed(const std::string &seq, bool error, size_t bytes) {
+    call_timing timing;
+    {
+      auto &shard = timings_of(seq);
+      std::lock_guard lock{shard.mutex};
+      const auto it = shard.calls.find(seq);
+      if (it == shard.calls.end()) {
+        return;
+      }
+      timing = std::move(it->second);
+      shard.calls.erase(it);
     }
-    browser_engine::navigate(url);
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    const auto now = stats_clock::now();
+    timing.stats->completed(
+        error, bytes,
+        duration_cast<microseconds>(timing.started - timing.received).count(),
+        duration_cast<microseconds>(now - timing.started).count());
   }
 
-  using binding_t = std::function<void(std::string, std::string, void *)>;
-  class binding_ctx_t {
-  public:
-    binding_ctx_t(binding_t *callback, void *arg, bool sync = true)
-        : callback(callback), arg(arg), sync(sync) {}
-    // This function is called upon execution of the bound JS function
-    binding_t *callback;
-    // This user-supplied argument is passed to the callback
-    void *arg;
-    // This boolean expresses whether or not this binding is synchronous or asynchronous
-    // Async bindings require the user to call the resolve function, sync bindings don't
-    bool sync;
+  // Runs a notification received at received (only set with statistics)
+  void notify(std::string_view name, const notification_binding_t &fn,
+              const std::string &req, stats_clock::time_point received) {
+    const bool timed = stats_enabled.load(std::memory_order_relaxed) &&
+                       received != stats_clock::time_point{};
+    const auto started = timed ? stats_clock::now() : received;
+    bool error = false;
+    try {
+      fn(req);
+    } catch (...) {
+      error = true;
+    }
+    if (timed) {
+      using std::chrono::duration_cast;
+      using std::chrono::microseconds;
+      const auto binding = stats_of(name);
+      binding->called(req.size());
+      binding->completed(
+          error, 0,
+          duration_cast<microseconds>(started - received).count(),
+          duration_cast<microseconds>(stats_clock::now() - started).count());
+    }
+  }
+
+  std::atomic<bool> stats_enabled{false};
+  detail::binding_registry<detail::binding_stats> stats;
+  std::array<timing_shard, detail::binding_stats::shards> timings;
+
+  // Calls that can be stopped, by seq: those of cancellable bindings and,
+  // with a call timeout, all the others but streams
+  std::mutex tracked_mutex;
+  std::unordered_map<std::string, std::stop_source> tracked_calls;
+  std::atomic<size_t> tracked_count{0};
+  std::atomic<std::chrono::milliseconds> call_timeout{
+      std::chrono::milliseconds{0}};
+
+  struct binding_cache {
+    explicit binding_cache(const cache_options &options)
+        : options(options), results(options.ttl, options.max_bytes) {}
+    cache_options options;
+    detail::result_cache results;
   };
 
-  using sync_binding_t = std::function<std::string(std::string)>;
-  using sync_binding_ctx_t = std::pair<webview *, sync_binding_t>;
+  struct cache_miss {
+    std::shared_ptr<binding_cache> cache;
+    std::string key;
+    uint64_t generation = 0;
+  };
 
-  // Synchronous bind
-  void bind(const std::string &name, sync_binding_t fn) {
-    if (bindings.count(name) == 0) {
-      bindings[name] = new binding_ctx_t(
-          new binding_t(
-              [](const std::string &seq, const std::string &req, void *arg) {
-                auto pair = static_cast<sync_binding_ctx_t *>(arg);
-                pair->first->resolve(seq, 0, pair->second(req));
-              }),
-          new sync_binding_ctx_t(this, fn));
-      bind_js(name);
+  // Caches by binding name, and the calls that missed them by seq
+  detail::binding_registry<binding_cache> caches;
+  std::atomic<bool> caching{false};
+  std::mutex cache_mutex;
+  std::unordered_map<std::string, cache_miss> cache_misses;
+  std::atomic<size_t> cache_miss_count{0};
+
+  // Drives a call of a coroutine binding, started by start(), which keeps the
+  // binding alive until the call is over even if it gets unbound
+  template <typename F>
+  detail::detached_task run_task(std::string seq, F start) {
+    int status = 0;
+    std::string result;
+    try {
+      result = co_await start();
+    } catch (const rejection &r) {
+      status = 1;
+      result = r.json();
+    } catch (const std::exception &e) {
+      status = 1;
+      result = detail::json_escape(e.what());
+    } catch (...) {
+      status = 1;
+      result = "\"unknown error\"";
     }
+    resolve(seq, status, result);
   }
 
-  // Asynchronous bind
-  void bind(const std::string &name, binding_t f, void *arg) {
-    if (bindings.count(name) == 0) {
-      bindings[name] = new binding_ctx_t(new binding_t(f), arg, false);
-      bind_js(name);
-    }
+  template <typename Args> struct typed_args;
+  template <typename... T> struct typed_args<std::tuple<T...>> {
+    using type = std::tuple<detail::json_arg<T>...>;
+  };
+
+  template <auto Fn, typename Args> static decltype(auto) invoke(Args &args) {
+    return std::apply([](auto &...arg) { return Fn(std::move(arg.value)...); },
+                      args);
   }
 
-  void unbind(const std::string &name) {
-    if (bindings.find(name) != bindings.end()) {
-      auto js = "delete window['" + name + "'];";
-      init(js);
-      eval(js);
-      delete bindings[name]->callback;
-      if (bindings[name]->sync) {
-        delete static_cast<sync_binding_ctx_t *>(bindings[name]->arg);
+  // Returns the status of the call, result is its JSON result or error
+  template <auto Fn>
+  static int call_typed(std::string_view req, std::string &result) {
+    using signature = detail::fn_signature<decltype(Fn)>;
+    typename typed_args<typename signature::args>::type args;
+    if (!detail::decode_params(req, args, result)) {
+      return 1;
+    }
+    try {
+      if constexpr (std::is_void_v<typename signature::result>) {
+        invoke<Fn>(args);
+        result = "null";
+      } else {
+        detail::json_encode(invoke<Fn>(args), result);
       }
-      delete bindings[name];
-      bindings.erase(name);
+      return 0;
+    } catch (const rejection &r) {
+      result = r.json();
+    } catch (const std::exception &e) {
+      result.clear();
+      detail::json_escape(e.what(), result);
+    } catch (...) {
+      result = "\"unknown error\"";
     }
+    return 1;
   }
 
-  void resolve(const std::string &seq, int status, const std::string &result) {
-    dispatch([seq, status, result, this]() {
-      if (status == 0) {
-        eval("window._rpc[" + seq + "].resolve(" + result +
-             "); delete window._rpc[" + seq + "]");
-      } else {
-        eval("window._rpc[" + seq + "].reject(" + result +
-             "); delete window._rpc[" + seq + "]");
-      }
-    });
+  // req lives in the coroutine frame, so the arguments can be views of it
+  template <auto Fn> static task<std::string> call_typed_task(std::string req) {
+    using signature = detail::fn_signature<decltype(Fn)>;
+    using value_t =
+        typename detail::is_task<typename signature::result>::result;
+    typename typed_args<typename signature::args>::type args;
+    std::string result;
+    if (!detail::decode_params(req, args, result)) {
+      throw rejection(std::move(result));
+    }
+    if constexpr (std::is_void_v<value_t>) {
+      co_await invoke<Fn>(args);
+      result = "null";
+    } else {
+      detail::json_encode(co_await invoke<Fn>(args), result);
+    }
+    co_return result;
   }
 
-private:
-  void bind_js(const std::string &name) {
-    auto js = "(function() { var name = '" + name + "';" + R"(
-      var RPC = window._rpc = (window._rpc || {nextSeq: 1});
-      window[name] = function() {
-        var seq = RPC.nextSeq++;
-        var promise = new Promise(function(resolve, reject) {
-          RPC[seq] = {
-            resolve: resolve,
-            reject: reject,
-          };
-        });
-        window.external.invoke(JSON.stringify({
-          id: seq,
-          method: name,
-          params: Array.prototype.slice.call(arguments),
-        }));
-        return promise;
-      }
-    })())";
-    init(js);
-    eval(js);
+  // Both are also used by coroutines, from any thread
+  detail::thread_pool &worker_pool() {
+    std::call_once(pool_once, [this] {
+      pool = std::make_unique<detail::thread_pool>(
+          pool_size ? pool_size
+                    : std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    });
+    return *pool;
   }
 
-  void on_message(const std::string &msg) {
-    auto seq = detail::json_parse(msg, "id", 0);
-    auto name = detail::json_parse(msg, "method", 0);
-    auto args = detail::json_parse(msg, "params", 0);
-    if (bindings.find(name) == bindings.end()) {
-      return;
-    }
-    auto fn = bindings[name];
-    (*fn->callback)(seq, args, fn->arg);
+  detail::timer_queue &timer_thread() {
+    std::call_once(timers_once,
+                   [this] { timers = std::make_unique<detail::timer_queue>(); });
+    return *timers;
   }
 
-  std::map<std::string, binding_ctx_t *> bindings;
+  std::shared_ptr<liveness> alive = std::make_shared<liveness>(this);
+  size_t pool_size = 0;
+  std::once_flag pool_once;
+  std::once_flag timers_once;
+  // last, so that they are stopped before anything they use is destroyed
+  std::unique_ptr<detail::thread_pool> pool;
+  std::unique_ptr<detail::timer_queue> timers;
 };
 } // namespace webview
 
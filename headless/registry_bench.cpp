@@ -0,0 +1,127 @@
+// Binding lookup benchmark: webview::detail::binding_registry against the
+// std::map it replaced, with 10 and 1000 bindings, and the registry with
+// several threads looking up at once. Every lookup copies the context, as
+// a call does. Usage: registry_bench [lookups per thread]
+
+#include "webview.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct context {
+  int id;
+};
+
+std::vector<std::string> binding_names(size_t count) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < count; ++i) {
+    names.push_back("binding_" + std::to_string(i));
+  }
+  return names;
+}
+
+// The names looked up, in an order the branch predictor can't learn
+std::vector<std::string_view>
+lookup_order(const std::vector<std::string> &names, unsigned seed) {
+  std::vector<std::string_view> order;
+  std::mt19937 random{seed};
+  std::uniform_int_distribution<size_t> pick{0, names.size() - 1};
+  for (size_t i = 0; i < 4096; ++i) {
+    order.push_back(names[pick(random)]);
+  }
+  return order;
+}
+
+// Nanoseconds per lookup
+template <typename Find>
+double measure(const std::vector<std::string_view> &order, long lookups,
+               Find find) {
+  long found = 0;
+  const auto start = clock_type::now();
+  for (long i = 0; i < lookups; ++i) {
+    found += find(order[i & (order.size() - 1)]) != nullptr;
+  }
+  const auto elapsed = clock_type::now() - start;
+  if (found != lookups) {
+    std::fprintf(stderr, "lookup failed\n");
+    std::exit(EXIT_FAILURE);
+  }
+  return std::chrono::duration<double, std::nano>(elapsed).count() / lookups;
+}
+
+void run(size_t bindings, long lookups, unsigned threads) {
+  const auto names = binding_names(bindings);
+  webview::detail::binding_registry<context> registry;
+  std::map<std::string, std::shared_ptr<context>> map;
+  std::map<std::string, std::shared_ptr<context>, std::less<>> transparent_map;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const auto ctx = std::make_shared<context>(context{static_cast<int>(i)});
+    registry.insert(names[i], ctx);
+    map.emplace(names[i], ctx);
+    transparent_map.emplace(names[i], ctx);
+  }
+  const auto order = lookup_order(names, 1);
+
+  // the window thread used to look a call up by a std::string
+  const auto map_ns = measure(order, lookups, [&](std::string_view name) {
+    const auto it = map.find(std::string(name));
+    return it != map.end() ? it->second : nullptr;
+  });
+  const auto transparent_map_ns =
+      measure(order, lookups, [&](std::string_view name) {
+        const auto it = transparent_map.find(name);
+        return it != transparent_map.end() ? it->second : nullptr;
+      });
+  const auto registry_ns =
+      measure(order, lookups,
+              [&](std::string_view name) { return registry.find(name); });
+
+  // every thread looks up its own sequence of names at once
+  std::vector<double> threaded_ns(threads);
+  {
+    std::vector<std::jthread> readers;
+    for (unsigned t = 0; t < threads; ++t) {
+      readers.emplace_back([&, t] {
+        const auto own_order = lookup_order(names, t + 2);
+        threaded_ns[t] =
+            measure(own_order, lookups, [&](std::string_view name) {
+              return registry.find(name);
+            });
+      });
+    }
+  }
+  double threaded_max = 0;
+  for (const auto ns : threaded_ns) {
+    threaded_max = std::max(threaded_max, ns);
+  }
+
+  std::printf("%8zu %16.1f %16.1f %10.1f %12.1f\n", bindings, map_ns,
+              transparent_map_ns, registry_ns, threaded_max);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const long lookups = argc > 1 ? std::atol(argv[1]) : 10000000;
+  if (lookups <= 0) {
+    std::fprintf(stderr, "usage: registry_bench [lookups per thread]\n");
+    return EXIT_FAILURE;
+  }
+  const auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+  std::printf("ns per lookup, %ld lookups (the last column is the slowest of "
+              "%u threads looking up at once)\n",
+              lookups, threads);
+  std::printf("%8s %16s %16s %10s %12s\n", "bindings", "map<string>",
+              "map<string,less>", "registry", "registry/mt");
+  for (const auto bindings : {10, 1000}) {
+    run(bindings, lookups, threads);
+  }
+  return EXIT_SUCCESS;
+}
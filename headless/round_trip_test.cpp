@@ -0,0 +1,140 @@
+// Round trips through webview::webview with the headless engine: a scripted
+// page calls bindings as window.external.invoke would and checks what the
+// page gets back, both as web messages and through eval.
+
+#include "webview.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+// A page that posts the calls it's given once its document is loaded and
+// collects what settles them: seq -> [seq,status,result]
+class scripted_page {
+public:
+  scripted_page(webview::webview &w, std::vector<std::string> calls)
+      : m_webview(w), m_calls(std::move(calls)) {
+    w.set_page({[this](const std::string &) { post_calls(); },
+                [this](const std::string &js) { on_eval(js); },
+                [this](const std::string &json) { receive(json); }});
+  }
+
+  std::map<int, std::string> settled;
+  int evaluated = 0;
+  // results that are JS but not JSON can only be evaluated
+  std::string script_results;
+
+private:
+  void post_calls() {
+    for (const auto &call : m_calls) {
+      m_webview.post_message(call);
+    }
+  }
+
+  void on_eval(const std::string &js) {
+    const std::string prefix = "window._rpc.receive(";
+    if (js.rfind(prefix, 0) == 0) {
+      ++evaluated;
+      const auto message =
+          js.substr(prefix.size(), js.size() - prefix.size() - 1);
+      if (message.find("undefined") != std::string::npos) {
+        script_results += message;
+        settled[5] = "[5,0,undefined]";
+        finish_if_settled();
+      } else {
+        receive(message);
+      }
+    }
+  }
+
+  void receive(std::string_view json) {
+    webview::detail::json_document doc;
+    check(doc.parse(json), "the page gets valid JSON");
+    const auto settle = doc.root()["settle"];
+    for (size_t i = 0; i < settle.size(); ++i) {
+      int seq = 0;
+      settle[i][0].get(seq);
+      settled[seq] = std::string(settle[i].raw());
+    }
+    finish_if_settled();
+  }
+
+  void finish_if_settled() {
+    if (settled.size() == m_calls.size()) {
+      m_webview.terminate();
+    }
+  }
+
+  webview::webview &m_webview;
+  std::vector<std::string> m_calls;
+};
+
+void round_trips(bool web_messages) {
+  webview::webview w;
+  w.set_web_messages(web_messages);
+  w.bind("echo", [](std::string params) { return params; });
+  w.bind("pooled", [](std::string params) { return params; },
+         {webview::webview::execution::pool});
+  w.bind(
+      "fail",
+      [&w](std::string seq, std::string, void *) {
+        w.resolve(seq, 1, "\"failed\"");
+      },
+      nullptr);
+  w.bind(
+      "nothing",
+      [&w](std::string seq, std::string, void *) { w.resolve(seq, 0, ""); },
+      nullptr);
+  w.bind(
+      "script",
+      [&w](std::string seq, std::string, void *) {
+        w.resolve(seq, 0, "undefined");
+      },
+      nullptr);
+
+  scripted_page page{
+      w,
+      {R"({"id":1,"method":"echo","params":[1,"a"]})",
+       R"({"id":2,"method":"pooled","params":[{"b":[2]}]})",
+       R"({"id":3,"method":"fail","params":[]})",
+       R"({"id":4,"method":"nothing","params":[]})",
+       R"({"id":5,"method":"script","params":[]})"}};
+  w.set_title("round trip");
+  w.navigate("https://example.org/");
+  w.run();
+
+  check(page.settled[1] == R"([1,0,[1,"a"]])", "sync binding result");
+  check(page.settled[2] == R"([2,0,[{"b":[2]}]])", "pool binding result");
+  check(page.settled[3] == R"([3,1,"failed"])", "rejected call");
+  check(page.settled[4] == "[4,0]", "call resolved without a result");
+  check(page.script_results == R"({"settle":[[5,0,undefined]]})",
+        "a result that is not JSON is evaluated on its own");
+  check(web_messages ? page.evaluated == 1 : page.evaluated > 1,
+        "results reach the page through the expected transport");
+  check(w.url() == "https://example.org/" && w.title() == "round trip",
+        "navigate and set_title are recorded");
+  check(!w.inits().empty(), "the bindings runtime is injected");
+}
+
+} // namespace
+
+int main() {
+  round_trips(true);
+  round_trips(false);
+  if (failures) {
+    return EXIT_FAILURE;
+  }
+  std::puts("round trips: ok");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// RPC round trip benchmark with the headless engine: a scripted page keeps
+// one call in flight, sending the next one as soon as the previous settles,
+// and the time from post_message to the page receiving the result is
+// measured for each call. Usage: rpc_bench [calls]
+
+#include "webview.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct outcome {
+  double calls_per_second;
+  double p50_us;
+  double p99_us;
+  double max_us;
+};
+
+outcome run(webview::webview &w, const std::string &method, int calls) {
+  std::vector<clock_type::time_point> sent(calls + 1);
+  std::vector<double> latencies;
+  latencies.reserve(calls);
+
+  auto send = [&](int seq) {
+    sent[seq] = clock_type::now();
+    w.post_message("{\"id\":" + std::to_string(seq) + ",\"method\":\"" +
+                   method + "\",\"params\":[" + std::to_string(seq) + "]}");
+  };
+  auto receive = [&](std::string_view json) {
+    webview::detail::json_document doc;
+    doc.parse(json);
+    const auto settle = doc.root()["settle"];
+    for (size_t i = 0; i < settle.size(); ++i) {
+      int seq = 0;
+      settle[i][0].get(seq);
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+                              clock_type::now() - sent[seq])
+                              .count());
+      if (seq == calls) {
+        w.terminate();
+      } else {
+        send(seq + 1);
+      }
+    }
+  };
+  const std::string prefix = "window._rpc.receive(";
+  w.set_page({{},
+              [&](const std::string &js) {
+                if (js.rfind(prefix, 0) == 0) {
+                  receive(std::string_view{js}.substr(
+                      prefix.size(), js.size() - prefix.size() - 1));
+                }
+              },
+              [&](const std::string &json) { receive(json); }});
+
+  const auto start = clock_type::now();
+  send(1);
+  w.run();
+  const auto seconds =
+      std::chrono::duration<double>(clock_type::now() - start).count();
+  // what reached the page is recorded by the engine
+  w.take_evals();
+  w.take_web_messages();
+
+  std::sort(latencies.begin(), latencies.end());
+  return {calls / seconds, latencies[latencies.size() / 2],
+          latencies[latencies.size() * 99 / 100], latencies.back()};
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const auto calls = argc > 1 ? std::atoi(argv[1]) : 100000;
+  if (calls <= 0) {
+    std::fprintf(stderr, "usage: rpc_bench [calls]\n");
+    return EXIT_FAILURE;
+  }
+
+  webview::webview w;
+  w.bind("echo", [](std::string params) { return params; });
+  w.bind("pooled", [](std::string params) { return params; },
+         {webview::webview::execution::pool});
+
+  std::printf("%d round trips, one call in flight\n", calls);
+  std::printf("%-8s %-13s %12s %10s %10s %10s\n", "binding", "transport",
+              "calls/s", "p50 us", "p99 us", "max us");
+  for (const auto *method : {"echo", "pooled"}) {
+    for (const auto web_messages : {true, false}) {
+      w.set_web_messages(web_messages);
+      const auto o = run(w, method, calls);
+      std::printf("%-8s %-13s %12.0f %10.2f %10.2f %10.2f\n", method,
+                  web_messages ? "web message" : "eval", o.calls_per_second,
+                  o.p50_us, o.p99_us, o.max_us);
+    }
+  }
+  return EXIT_SUCCESS;
+}